@@ -4,14 +4,18 @@ typedef long int off_t;
 #endif
 struct buf;
 struct context;
+struct execseg;
 struct file;
 struct inode;
+struct kmem_cache;
 struct pipe;
 struct proc;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct timer;
+struct vma;
 #ifdef LAB_NET
 struct mbuf;
 struct sock;
@@ -32,6 +36,10 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+int             kexec(struct proc*, char*, char**);
+struct execseg* findseg(struct proc*, uint64);
+uint64          loadpage(struct proc*, struct execseg*, uint64, int);
+void            loadrange(struct proc*, uint64, uint64);
 
 // file.c
 struct file*    filealloc(void);
@@ -48,6 +56,8 @@ int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
+struct inode*   iexecdup(struct inode*);
+void            iexecput(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
 void            iput(struct inode*);
@@ -71,8 +81,21 @@ void            ramdiskrw(struct buf*);
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+void*           kalloc_order(int);
+void            kfree_order(void *, int);
+void            ksplit(void *, int);
+int             kreserve(uint64);
+void            kunreserve(uint64);
+void*           kalloc_zeroed(void);
+int             kzero_idle(void);
+uint64          fmemory_counting(void);
 void            count_incre(uint64 pa);
+void            count_init(uint64 pa, int num);
+int             count_decre(uint64 pa);
 int             count_check(uint64 pa, int expected);
+int             count_tryincre(uint64 pa);
+void            count_setcached(uint64 pa);
+int             count_cached(uint64 pa);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -80,7 +103,24 @@ void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
 
+// mmap.c
+struct vma*     findvma(struct proc*, uint64);
+uint64          heaplimit(struct proc*);
+uint64          mmap(uint64, int, int, struct file*, uint64);
+uint64          mmapfault(struct proc*, struct vma*, uint64);
+int             munmap(uint64, uint64);
+void            munmapall(struct proc*);
+int             mmapcopy(struct proc*, struct proc*);
+
+// pagecache.c
+void            pagecacheinit(void);
+uint64          pagecache_get(struct inode*, uint);
+void            pagecache_drop(uint64);
+void            pagecache_write(uint, uint, uint, char*, uint);
+void            pagecache_trunc(uint, uint);
+
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
@@ -96,11 +136,13 @@ void            backtrace(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
+int             spawn(char*, char**, struct file**);
 int             growproc(int);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
 int             kill(int);
+int             setpriority(int, int);
 int             killed(struct proc*);
 void            setkilled(struct proc*);
 struct cpu*     mycpu(void);
@@ -118,6 +160,12 @@ int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
 
+// reclaim.c
+void            reclaiminit(void);
+int             reclaim(int);
+void            reclaimtick(void);
+uint64          reclaimed(void);
+
 // swtch.S
 void            swtch(struct context*, struct context*);
 
@@ -133,6 +181,12 @@ int             atomic_read4(int *addr);
 void            freelock(struct spinlock*);
 #endif
 
+// slab.c
+void            slabinit(void);
+struct kmem_cache* kmem_cache_create(char*, uint);
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
@@ -148,6 +202,15 @@ int             strlen(const char*);
 int             strncmp(const char*, const char*, uint);
 char*           strncpy(char*, const char*, int);
 
+// swap.c
+void            swapinit(int, struct superblock*);
+int             swapalloc(uint64);
+void            swapout(int);
+uint64          swapin(int);
+void            swapdup(int);
+void            swapfree(int);
+uint64          swapused(void);
+
 // syscall.c
 void            argint(int, int*);
 int             argstr(int, char*, int);
@@ -156,9 +219,19 @@ int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
 
+// timer.c
+void            timerinit(void);
+void            timer_add(struct timer*, uint);
+int             timer_del(struct timer*);
+void            timertick(uint);
+int             sleepticks(uint);
+
 // trap.c
 extern uint     ticks;
 void            trapinit(void);
+void            clockoff(void);
+void            clockon(void);
+void            ipi(int);
 void            trapinithart(void);
 extern struct spinlock tickslock;
 void            usertrapret(void);
@@ -176,20 +249,30 @@ void            kvminit(void);
 void            kvminithart(void);
 void            kvmmap(pagetable_t, uint64, uint64, uint64, int);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
+int             mapleaves(pagetable_t, uint64, uint64, uint64, int, int);
+int             uvmsplit(pagetable_t, uint64);
+int             uvmunshare(pagetable_t, uint64);
+int             uvmdropped(pagetable_t, uint64);
+int             uvmswapped(pagetable_t, uint64);
+uint64          uvmlazy(pagetable_t, uint64, uint64, uint64, int);
+uint64          uvmzero(pagetable_t, uint64, int);
+int             iszeropage(uint64);
+uint64          lazyfault(pagetable_t, uint64, int);
 pagetable_t     uvmcreate(void);
 void            uvmfirst(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
 void            uvmfree(pagetable_t, uint64);
-void            uvmunmap(pagetable_t, uint64, uint64, int);
+uint64          uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
 pte_t *         walk(pagetable_t, uint64, int);
+pte_t *         walkleaf(pagetable_t, uint64, int *);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
-int             cow_fault_handler(pagetable_t pagetable, uint64 va);
+uint64          cow_fault_handler(pagetable_t pagetable, uint64 va);
 int             is_cow(pagetable_t pagetable, uint64 va);
 
 // plic.c
@@ -201,6 +284,7 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_rwpage(uint, void *, int);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
@@ -6,8 +6,9 @@
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
-
-static int loadseg(pde_t *, uint64, struct inode *, uint, uint);
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
 
 int flags2perm(int flags)
 {
@@ -21,15 +22,28 @@ int flags2perm(int flags)
 
 int
 exec(char *path, char **argv)
+{
+  return kexec(myproc(), path, argv);
+}
+
+// Replace the user image of p, which is either the current
+// process or a new one that spawn() has not started yet,
+// with the program path.
+// The program's segments are not read in here: kexec() only
+// records them, with a reference to the executable, and
+// reserves their memory. Each page is read from the file on
+// its first page fault, see loadpage().
+int
+kexec(struct proc *p, char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
+  int i, off, nseg = 0;
   uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase;
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *exe = 0, *oldexe;
   struct proghdr ph;
+  struct execseg seg[NSEG];
   pagetable_t pagetable = 0, oldpagetable;
-  struct proc *p = myproc();
 
   begin_op();
 
@@ -49,7 +63,7 @@ exec(char *path, char **argv)
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Record the program's segments.
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -61,18 +75,30 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
+    if(ph.vaddr < sz || ph.vaddr + ph.memsz >= TRAPFRAME - PGSIZE)
+      goto bad;
+    if(ph.off + ph.filesz < ph.off)
+      goto bad;
+    if(nseg == NSEG)
       goto bad;
-    sz = sz1;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    // like uvmalloc() did, the segment's memory starts
+    // at the first page after the previous one.
+    seg[nseg].start = PGROUNDUP(sz);
+    seg[nseg].end = ph.vaddr + ph.memsz;
+    seg[nseg].vaddr = ph.vaddr;
+    seg[nseg].off = ph.off;
+    seg[nseg].filesz = ph.filesz;
+    seg[nseg].perm = flags2perm(ph.flags) | PTE_R | PTE_U;
+    if(kreserve((PGROUNDUP(seg[nseg].end) - seg[nseg].start) / PGSIZE) < 0)
       goto bad;
+    sz = seg[nseg].end;
+    nseg++;
   }
+  exe = iexecdup(ip);
   iunlockput(ip);
   end_op();
   ip = 0;
 
-  p = myproc();
   uint64 oldsz = p->sz;
 
   // Allocate two pages at the next page boundary.
@@ -121,12 +147,26 @@ exec(char *path, char **argv)
   safestrcpy(p->name, last, sizeof(p->name));
     
   // Commit to the user image.
+  munmapall(p);
+  // the old image's sigalarm() handler is gone with it
+  p->interval = -1;
+  p->handler = 0;
+  p->is_handler = 0;
   oldpagetable = p->pagetable;
+  oldexe = p->exe;
   p->pagetable = pagetable;
   p->sz = sz;
+  p->exe = exe;
+  memmove(p->seg, seg, sizeof(seg));
+  p->nseg = nseg;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
   proc_freepagetable(oldpagetable, oldsz);
+  if(oldexe){
+    begin_op();
+    iexecput(oldexe);
+    end_op();
+  }
 
   if(p -> pid == 1)
   {
@@ -142,30 +182,128 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  if(exe){
+    begin_op();
+    iexecput(exe);
+    end_op();
+  }
   return -1;
 }
 
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
-// Returns 0 on success, -1 on failure.
-static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
+// Return the segment of p that va belongs to, or 0.
+struct execseg*
+findseg(struct proc *p, uint64 va)
 {
-  uint i, n;
-  uint64 pa;
-
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
-      return -1;
+  for(int i = 0; i < p->nseg; i++){
+    if(va >= p->seg[i].start && va < p->seg[i].end)
+      return &p->seg[i];
   }
-  
   return 0;
 }
+
+// Read the page at va of segment s from p's executable
+// and map it. The page must not be mapped yet, and its
+// memory was reserved by exec(), unless reclaim() dropped
+// it after it was read in before.
+// A read-only page that holds nothing but file contents,
+// such as a page of program text, comes from the page
+// cache, shared with the other processes running the
+// same program. A page that is all BSS maps the zero page
+// instead, unless it is about to be written.
+// Returns the physical address of the page, or 0 if
+// memory ran out or the file could not be read.
+uint64
+loadpage(struct proc *p, struct execseg *s, uint64 va, int write)
+{
+  char *mem;
+  uint64 from, to, pa;
+  int locked, shared, dropped;
+
+  va = PGROUNDDOWN(va);
+  dropped = uvmdropped(p->pagetable, va);
+
+  // the part of the page that comes from the file
+  from = va > s->vaddr ? va : s->vaddr;
+  to = va + PGSIZE < s->vaddr + s->filesz ? va + PGSIZE : s->vaddr + s->filesz;
+  shared = (s->perm & PTE_W) == 0 && from == va && to == va + PGSIZE &&
+           (s->off + (va - s->vaddr)) % PGSIZE == 0;
+
+  if(from < to){
+    push_off();
+    locked = mycpu()->noff > 1;
+    pop_off();
+    if(locked){
+      // can't sleep in readi() with a spinlock held;
+      // system calls use loadrange() to avoid this.
+      return 0;
+    }
+    // the fault may come from a copy into or out of
+    // the executable itself, with its inode locked.
+    locked = holdingsleep(&p->exe->lock);
+    if(!locked)
+      ilock(p->exe);
+    if(shared){
+      pa = pagecache_get(p->exe, s->off + (va - s->vaddr));
+    } else {
+      pa = (uint64)(mem = kalloc_zeroed());
+      if(mem && readi(p->exe, 0, (uint64)mem + (from - va), s->off + (from - s->vaddr), to - from) != to - from){
+        kfree(mem);
+        pa = 0;
+      }
+    }
+    if(!locked)
+      iunlock(p->exe);
+  } else if(!write && !dropped){
+    //still reserved, until the first write
+    return uvmzero(p->pagetable, va, s->perm);
+  } else {
+    pa = (uint64)kalloc_zeroed();
+  }
+  if(pa == 0)
+    return 0;
+
+  // counts as used, so that reclaim() leaves it for a while
+  if(mappages(p->pagetable, va, PGSIZE, pa, s->perm | PTE_A) != 0){
+    kfree((void*)pa);
+    return 0;
+  }
+  if(!dropped)
+    kunreserve(1);
+  return pa;
+}
+
+// Read in the pages of the current process p in
+// [va, va+len) that come from its segments, mmap()ed files
+// or swap, and are not in memory. System calls call this
+// before copying to or from user memory with locks held,
+// where lazyfault() could not sleep or would deadlock.
+// p is pinned until the system call returns, so that
+// reclaim() does not drop the pages again meanwhile.
+void
+loadrange(struct proc *p, uint64 va, uint64 len)
+{
+  struct vma *v;
+  uint64 a, end;
+  int level;
+
+  if(va + len < va)
+    return;
+  p->pinned = 1;
+  end = va + len < p->sz ? va + len : p->sz;
+  for(a = PGROUNDDOWN(va); a < end; a += PGSIZE){
+    if(walkleaf(p->pagetable, a, &level) == 0 &&
+       (findseg(p, a) || uvmswapped(p->pagetable, a)) &&
+       lazyfault(p->pagetable, a, 0) == 0)
+      return;
+  }
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->f == 0)
+      continue;
+    a = PGROUNDDOWN(va) > v->start ? PGROUNDDOWN(va) : v->start;
+    end = va + len < v->end ? va + len : v->end;
+    for(; a < end; a += PGSIZE){
+      if(walkleaf(p->pagetable, a, &level) == 0 && lazyfault(p->pagetable, a, 0) == 0)
+        return;
+    }
+  }
+}
@@ -4,7 +4,6 @@
 #define O_CREATE  0x200
 #define O_TRUNC   0x400
 
-#ifdef LAB_MMAP
 #define PROT_NONE       0x0
 #define PROT_READ       0x1
 #define PROT_WRITE      0x2
@@ -12,4 +11,3 @@
 
 #define MAP_SHARED      0x01
 #define MAP_PRIVATE     0x02
-#endif
@@ -14,33 +14,34 @@
 #include "proc.h"
 
 struct devsw devsw[NDEV];
+
+// Open files are allocated from a slab cache, so their
+// number is only limited by memory. ftable.lock protects
+// the files' reference counts.
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
+  struct kmem_cache *cache;
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  ftable.cache = kmem_cache_create("file", sizeof(struct file));
 }
 
 // Allocate a file structure.
+// Returns 0 if out of memory.
 struct file*
 filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = kmem_cache_alloc(ftable.cache)) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -72,6 +73,7 @@ fileclose(struct file *f)
   f->ref = 0;
   f->type = FD_NONE;
   release(&ftable.lock);
+  kmem_cache_free(ftable.cache, f);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
@@ -25,6 +25,10 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  int nexec;          // processes running it, see iexecdup()
+  struct inode *hnext;  // itable hash chain
+  struct inode *prev;   // itable LRU list, while ref == 0
+  struct inode *next;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -44,6 +44,7 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  swapinit(dev, &sb);
 }
 
 // Zero a block.
@@ -129,12 +130,14 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in table: an entry in the inode table
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
+// * Referencing in table: in-memory inodes are allocated
+//   from a slab cache and hashed by (dev, inum). ip->ref
+//   tracks the number of in-memory pointers to the entry
+//   (open files and current directories). iget() finds or
 //   creates a table entry and increments its ref; iput()
-//   decrements ref.
+//   decrements ref. Up to NINODE entries whose ref has
+//   fallen to zero stay cached on an LRU list, and the
+//   least recently used one is freed beyond that.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   table entry is only correct when ip->valid is 1.
@@ -173,20 +176,39 @@ bfree(int dev, uint b)
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH 31
+#define IHASH(dev, inum) (((dev) + (inum)) % NIHASH)
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct kmem_cache *cache;
+  struct inode *hash[NIHASH]; // every in-memory inode, by (dev, inum)
+  struct inode unused;        // LRU list head of inodes with ref 0
+  int nunused;
 } itable;
 
 void
 iinit()
 {
-  int i = 0;
-  
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
-  }
+  itable.cache = kmem_cache_create("inode", sizeof(struct inode));
+  itable.unused.next = itable.unused.prev = &itable.unused;
+}
+
+// Remove ip from the hash table and free it.
+// Caller must hold itable.lock, and ip->ref must be 0.
+static void
+ifree(struct inode *ip)
+{
+  struct inode **pp;
+
+  for(pp = &itable.hash[IHASH(ip->dev, ip->inum)]; *pp != ip; pp = &(*pp)->hnext)
+    ;
+  *pp = ip->hnext;
+#ifdef LAB_LOCK
+  freelock(&ip->lock.lk);
+#endif
+  kmem_cache_free(itable.cache, ip);
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -246,31 +268,44 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
 
   acquire(&itable.lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = itable.hash[IHASH(dev, inum)]; ip != 0; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0){
+        // take it off the unused list
+        ip->prev->next = ip->next;
+        ip->next->prev = ip->prev;
+        itable.nunused--;
+      }
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+  // Allocate a new entry, recycling the least recently
+  // used cached one if memory is short.
+  while((ip = kmem_cache_alloc(itable.cache)) == 0){
+    if(itable.nunused == 0)
+      panic("iget: no inodes");
+    ip = itable.unused.next;
+    ip->prev->next = ip->next;
+    ip->next->prev = ip->prev;
+    itable.nunused--;
+    ifree(ip);
+  }
 
-  ip = empty;
+  initsleeplock(&ip->lock, "inode");
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
+  ip->nexec = 0;
   ip->valid = 0;
+  ip->hnext = itable.hash[IHASH(dev, inum)];
+  itable.hash[IHASH(dev, inum)] = ip;
   release(&itable.lock);
 
   return ip;
@@ -287,6 +322,30 @@ idup(struct inode *ip)
   return ip;
 }
 
+// Like idup(), for a process that runs ip. While any process
+// does, its text is mapped from the page cache, and the file
+// must not change: see writei() and sys_open().
+struct inode*
+iexecdup(struct inode *ip)
+{
+  acquire(&itable.lock);
+  ip->ref++;
+  ip->nexec++;
+  release(&itable.lock);
+  return ip;
+}
+
+// Drop a reference taken by iexecdup().
+// Must be called inside a transaction, as iput() may be.
+void
+iexecput(struct inode *ip)
+{
+  acquire(&itable.lock);
+  ip->nexec--;
+  release(&itable.lock);
+  iput(ip);
+}
+
 // Lock the given inode.
 // Reads the inode from disk if necessary.
 void
@@ -358,6 +417,25 @@ iput(struct inode *ip)
   }
 
   ip->ref--;
+  if(ip->ref == 0){
+    if(ip->valid == 0){
+      // nothing worth caching (e.g. just freed on disk).
+      ifree(ip);
+    } else {
+      // keep it cached, most recently used at the tail.
+      ip->next = &itable.unused;
+      ip->prev = itable.unused.prev;
+      itable.unused.prev->next = ip;
+      itable.unused.prev = ip;
+      if(++itable.nunused > NINODE){
+        ip = itable.unused.next;
+        ip->prev->next = ip->next;
+        ip->next->prev = ip->prev;
+        itable.nunused--;
+        ifree(ip);
+      }
+    }
+  }
   release(&itable.lock);
 }
 
@@ -449,6 +527,7 @@ itrunc(struct inode *ip)
   
   ip->size = 0;
   iupdate(ip);
+  pagecache_trunc(ip->dev, ip->inum);
 }
 
 // Copy stat information from inode.
@@ -501,6 +580,7 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 // Returns the number of bytes successfully written.
 // If the return value is less than the requested n,
 // there was an error of some kind.
+// Fails if some process is running ip (ETXTBSY).
 int
 writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
@@ -509,6 +589,8 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 
   if(off > ip->size || off + n < off)
     return -1;
+  if(atomic_read4(&ip->nexec) != 0)
+    return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
@@ -522,6 +604,7 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
       brelse(bp);
       break;
     }
+    pagecache_write(ip->dev, ip->inum, off, (char*)bp->data + (off % BSIZE), m);
     log_write(bp);
     brelse(bp);
   }
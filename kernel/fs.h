@@ -7,10 +7,11 @@
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
-//                                          free bit map | data blocks]
+//                                  free bit map | data blocks | swap ]
 //
 // mkfs computes the super block and builds an initial file system. The
-// super block describes the disk layout:
+// super block describes the disk layout. The swap area lies past the
+// end of the file system proper, see swap.c:
 struct superblock {
   uint magic;        // Must be FSMAGIC
   uint size;         // Size of file system image (blocks)
@@ -20,6 +21,8 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint swapstart;    // Block number of first swap block
+  uint nswap;        // Number of swap blocks
 };
 
 #define FSMAGIC 0x10203040
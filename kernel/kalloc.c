@@ -1,6 +1,33 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers. Allocates whole 4096-byte pages,
+// or physically contiguous blocks of 2^order pages.
+//
+// Free memory is managed by a binary buddy allocator.
+// A free block of 2^order pages starts at a page index
+// (counted from KERNBASE) that is a multiple of 2^order,
+// and is merged with its buddy (index ^ 2^order) as soon
+// as both halves are free. Since KERNBASE is 2 MiB aligned,
+// so are the order-MAXORDER blocks.
+// Single pages are additionally cached on per-CPU freelists,
+// so kalloc()/kfree() usually only take the local CPU's lock.
+//
+// Memory is handed to the buddy lists lazily: kinit() only
+// frees the pages up to the first 2 MiB boundary after the
+// kernel, and the rest is claimed one 2 MiB region at a time,
+// as a single block, when the buddy lists run dry. So boot
+// does not touch the free pages and takes the same time
+// whatever PHYSTOP is.
+//
+// Pages are only filled with junk on kalloc()/kfree() in
+// kernels built with KJUNK=1, to catch uses of uninitialised
+// or freed memory. kalloc_zeroed() hands out pages that idle
+// CPUs zeroed ahead of time.
+//
+// Every free list keeps a count of its pages, so the amount
+// of free memory is a sum of NCPU+2 counters, read without
+// taking any lock. Each CPU also counts the pages it handed
+// out, took back and stole, for sysinfo().
 
 #include "types.h"
 #include "param.h"
@@ -8,91 +35,396 @@
 #include "spinlock.h"
 #include "riscv.h"
 #include "defs.h"
-
-struct refcnt
-{
-  struct spinlock lock;
-  int count;
+#include "sysinfo.h"
+
+#define NPAGE ((PHYSTOP - KERNBASE) / PGSIZE)
+#define PA2IDX(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+#define IDX2PA(i) (KERNBASE + (uint64)(i) * PGSIZE)
+
+// memory is claimed by the buddy lists in regions this big
+#define REGIONSIZE ((uint64)PGSIZE << MAXORDER)
+
+// Per-page metadata, one entry for each page between
+// KERNBASE and PHYSTOP.
+struct page {
+  int refcnt;   // number of references (page tables, kernel
+                // users) to the page or the block it heads;
+                // only updated with atomic instructions
+  uchar order;  // order+1 of the free buddy block starting
+                // at this page, 0 if none starts here;
+                // protected by buddy.lock
+  uchar cached; // has a page cache entry, see pagecache.c
 };
 
-struct refcnt count_array[(PHYSTOP - KERNBASE) / PGSIZE + 1];
-//This is a count array used for cow-fork 
+struct page pages[NPAGE];
+//The refcounts are used for cow-fork 
 //to record the number of references to each page
 
 void count_incre(uint64 pa)
 {
-  int index = (pa - KERNBASE) / PGSIZE;
-  acquire(&count_array[index].lock);
-  count_array[index].count++;
-  release(&count_array[index].lock);
+  // amoadd.w, no lock needed
+  __sync_fetch_and_add(&pages[PA2IDX(pa)].refcnt, 1);
 }
 
 void count_init(uint64 pa, int num)
 {
-  int index = (pa - KERNBASE) / PGSIZE;
-  acquire(&count_array[index].lock);
-  count_array[index].count = num;
-  release(&count_array[index].lock);
+  __atomic_store_n(&pages[PA2IDX(pa)].refcnt, num, __ATOMIC_SEQ_CST);
 }
 
-void count_decre(uint64 pa)
+// Drop a reference, returning how many are left.
+int count_decre(uint64 pa)
 {
-  int index = (pa - KERNBASE) / PGSIZE;
-  acquire(&count_array[index].lock);
-  count_array[index].count--;
-  release(&count_array[index].lock);
+  return __sync_sub_and_fetch(&pages[PA2IDX(pa)].refcnt, 1);
 }
 
 int count_check(uint64 pa, int expected)
 {
-  int index = (pa - KERNBASE) / PGSIZE;
-  acquire(&count_array[index].lock);
-  int cnt = count_array[index].count;
-  release(&count_array[index].lock);
-  return cnt == expected;
+  return atomic_read4(&pages[PA2IDX(pa)].refcnt) == expected;
 }
 
-void freerange(void *pa_start, void *pa_end);
+// Take a reference to pa, unless it has none left because
+// it is being freed. Returns 1 if a reference was taken.
+int count_tryincre(uint64 pa)
+{
+  int *refcnt = &pages[PA2IDX(pa)].refcnt;
+  int n;
+
+  do {
+    n = atomic_read4(refcnt);
+    if(n == 0)
+      return 0;
+  } while(!__sync_bool_compare_and_swap(refcnt, n, n + 1));
+  return 1;
+}
+
+// Mark pa as having a page cache entry, which kfree()
+// must drop before the page can be reused.
+void count_setcached(uint64 pa)
+{
+  pages[PA2IDX(pa)].cached = 1;
+}
+
+// Is pa in the page cache? Its contents belong to the file,
+// so even its last user must copy it to write to it.
+int count_cached(uint64 pa)
+{
+  return pages[PA2IDX(pa)].cached;
+}
+
+static void freerange(void *pa_start, void *pa_end);
+static void buddy_free(void *pa, int order);
+static void buddy_free_locked(void *pa, int order);
+static void *buddy_alloc(int order);
+static struct run *kzero_pop(void);
+static void *kalloc_noreclaim(void);
 
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
 struct run {
   struct run *next;
+  struct run *prev; // only used on the buddy lists
 };
 
+// Per-CPU page caches, in pages. An empty cache is refilled
+// up to KMEM_LOW pages at once, and a cache that grows past
+// KMEM_HIGH gives its surplus back to the buddy lists, down
+// to KMEM_LOW again.
+#define KMEM_LOW   32
+#define KMEM_HIGH  128
+
 struct {
   struct spinlock lock;
   struct run *freelist;
+  int nfree;            // number of pages on freelist
+  // only updated by their own CPU, with interrupts off
+  uint64 nalloc;        // pages handed out by kalloc()
+  uint64 nfreed;        // pages whose last reference kfree() dropped
+  uint64 nsteal;        // pages taken from other CPUs' caches
 } kmem[NCPU];
 
+// Free pages promised to lazily grown user memory
+// (see growproc()), and not allocated yet. They are not
+// counted as free memory.
+struct {
+  struct spinlock lock;
+  int n;
+} reserve;
+
+// Pages kalloc() has reclaim() free when the lists are empty.
+#define RECLAIMBATCH 32
+
+// Pages zeroed by idle CPUs, waiting for kalloc_zeroed().
+// They still count as free memory.
+#define KZERO_MAX  64
+
+struct {
+  struct spinlock lock;
+  struct run *list;
+  int n;
+} kzero;
+
+struct {
+  struct spinlock lock;
+  struct run free[MAXORDER + 1]; // circular list heads, one per order
+  int nfree;                     // pages on all the lists
+  uint64 unclaimed;              // start of memory not yet on the lists,
+                                 // 2 MiB aligned (or PHYSTOP)
+} buddy;
+
 // struct spinlock kmem_master_lock;
 // //Newly added : a new lock to protect the kmem array(as a whole)
 
 void
 kinit()
 {
+  uint64 first = PGROUNDUP((uint64)end);
+
   for(int i = 0; i < NCPU; i++)
   {
     initlock(&kmem[i].lock, "kmem");
   }
-  for(int i = 0; i < (PHYSTOP - KERNBASE) / PGSIZE; i++)
+  initlock(&buddy.lock, "buddy");
+  initlock(&kzero.lock, "kzero");
+  initlock(&reserve.lock, "reserve");
+  for(int k = 0; k <= MAXORDER; k++)
   {
-    initlock(&count_array[i].lock, "refcnt");
+    buddy.free[k].next = buddy.free[k].prev = &buddy.free[k];
   }
-  freerange(end, (void*)PHYSTOP);
+  //pages[] is in bss: every refcount is already 0.
+  //free the pages up to the first region boundary now,
+  //the regions after it when they are first needed
+  buddy.unclaimed = KERNBASE + (first - KERNBASE + REGIONSIZE - 1) / REGIONSIZE * REGIONSIZE;
+  if(buddy.unclaimed > PHYSTOP)
+    buddy.unclaimed = PHYSTOP;
+  acquire(&buddy.lock);
+  freerange((void*)first, (void*)buddy.unclaimed);
+  release(&buddy.lock);
 }
 
-void
+// Put the pages in [pa_start, pa_end) on the buddy lists,
+// as the largest aligned blocks that fit.
+// Caller must hold buddy.lock.
+static void
 freerange(void *pa_start, void *pa_end)
 {
-  char *p;
-  p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
+  uint64 p = PGROUNDUP((uint64)pa_start);
+  int k;
+
+  while(p + PGSIZE <= (uint64)pa_end)
+  {
+    for(k = MAXORDER; k > 0; k--)
+    {
+      uint64 size = (uint64)PGSIZE << k;
+      if((p - KERNBASE) % size == 0 && p + size <= (uint64)pa_end)
+        break;
+    }
+#ifdef KJUNK
+    // Fill with junk to catch dangling refs.
+    memset((void*)p, 1, (uint64)PGSIZE << k);
+#endif
+    buddy_free_locked((void*)p, k); //refcount is already 0
+    p += (uint64)PGSIZE << k;
+  }
+}
+
+// Claim the next region of never-used memory for the buddy
+// lists. Returns 0 if all of memory has been claimed.
+// Caller must hold buddy.lock.
+static int
+claim_region(void)
+{
+  uint64 start = buddy.unclaimed;
+  uint64 stop = start + REGIONSIZE;
+
+  if(start >= PHYSTOP)
+    return 0;
+  if(stop > PHYSTOP)
+    stop = PHYSTOP;
+  __atomic_store_n(&buddy.unclaimed, stop, __ATOMIC_RELAXED);
+  freerange((void*)start, (void*)stop);
+  return 1;
+}
+
+// Put a free block on the list for its order.
+// Caller must hold buddy.lock.
+static void
+buddy_push(struct run *r, int order)
+{
+  struct run *head = &buddy.free[order];
+
+  r->next = head->next;
+  r->prev = head;
+  head->next->prev = r;
+  head->next = r;
+  pages[PA2IDX(r)].order = order + 1;
+}
+
+// Take a free block off its list.
+// Caller must hold buddy.lock.
+static void
+buddy_unlink(struct run *r)
+{
+  r->prev->next = r->next;
+  r->next->prev = r->prev;
+  pages[PA2IDX(r)].order = 0;
+}
+
+// Return the 2^order pages at pa to the buddy lists,
+// merging with the free buddy as many times as possible.
+// Caller must hold buddy.lock.
+static void
+buddy_free_locked(void *pa, int order)
+{
+  uint64 i = PA2IDX(pa);
+  uint64 b;
+
+  buddy.nfree += 1 << order;
+  for(; order < MAXORDER; order++)
+  {
+    b = i ^ (1L << order);
+    if(b >= NPAGE || pages[b].order != order + 1)
+      break; //buddy is (partly) in use, or beyond PHYSTOP
+    buddy_unlink((struct run*)IDX2PA(b));
+    i &= ~(1L << order);
+  }
+  buddy_push((struct run*)IDX2PA(i), order);
+}
+
+static void
+buddy_free(void *pa, int order)
+{
+  acquire(&buddy.lock);
+  buddy_free_locked(pa, order);
+  release(&buddy.lock);
+}
+
+// Take a block of 2^order pages off the buddy lists,
+// splitting the smallest larger block if necessary.
+// Returns 0 if there is no big enough block.
+// Caller must hold buddy.lock.
+static void *
+buddy_alloc_locked(int order)
+{
+  struct run *r;
+  int k;
+
+  for(k = order; k <= MAXORDER; k++)
+  {
+    if(buddy.free[k].next != &buddy.free[k])
+      break;
+  }
+  if(k > MAXORDER)
+  {
+    //lists are dry, bring in more memory
+    if(!claim_region())
+      return 0;
+    return buddy_alloc_locked(order);
+  }
+
+  r = buddy.free[k].next;
+  buddy_unlink(r);
+  buddy.nfree -= 1 << order;
+  while(k > order)
+  {
+    //keep the lower half, give back the upper half
+    k--;
+    buddy_push((struct run*)((char*)r + ((uint64)PGSIZE << k)), k);
+  }
+  return (void*)r;
+}
+
+static void *
+buddy_alloc(int order)
+{
+  void *pa;
+
+  acquire(&buddy.lock);
+  pa = buddy_alloc_locked(order);
+  release(&buddy.lock);
+  return pa;
+}
+
+// Refill an empty per-CPU cache with up to KMEM_LOW pages
+// from the buddy lists, in one buddy.lock acquisition.
+// Caller must hold kmem[cpu_id].lock.
+static void
+kmem_refill(int cpu_id)
+{
+  struct run *r;
+
+  acquire(&buddy.lock);
+  while(kmem[cpu_id].nfree < KMEM_LOW && (r = buddy_alloc_locked(0)) != 0)
+  {
+    r -> next = kmem[cpu_id].freelist;
+    kmem[cpu_id].freelist = r;
+    kmem[cpu_id].nfree++;
+  }
+  release(&buddy.lock);
+}
+
+// Give a per-CPU cache that has grown past KMEM_HIGH
+// back to the buddy lists, down to KMEM_LOW pages.
+// Caller must hold kmem[cpu_id].lock.
+static void
+kmem_drain(int cpu_id)
+{
+  struct run *r;
+
+  acquire(&buddy.lock);
+  while(kmem[cpu_id].nfree > KMEM_LOW)
   {
-    count_init((uint64) p, 1); //set the initial refcount to 1
-    kfree(p); //This will decrement the refcount to 0 and free it
+    r = kmem[cpu_id].freelist;
+    kmem[cpu_id].freelist = r -> next;
+    kmem[cpu_id].nfree--;
+    buddy_free_locked(r, 0);
   }
+  release(&buddy.lock);
+}
+
+// Steal half of the first non-empty cache of another CPU.
+// Returns one of the stolen pages and puts the rest on
+// cpu_id's cache. Only one kmem lock is held at a time,
+// so two CPUs stealing from each other cannot deadlock.
+static struct run *
+kmem_steal(int cpu_id)
+{
+  struct run *r, *last;
+  int n;
+
+  for(int i = 1; i < NCPU; i++)
+  {
+    int victim = (cpu_id + i) % NCPU;
+
+    acquire(&kmem[victim].lock);
+    r = kmem[victim].freelist;
+    if(r == 0)
+    {
+      release(&kmem[victim].lock);
+      continue;
+    }
+    //detach the first half (rounded up) of the victim's list
+    n = (kmem[victim].nfree + 1) / 2;
+    last = r;
+    for(int j = 1; j < n; j++)
+      last = last -> next;
+    kmem[victim].freelist = last -> next;
+    kmem[victim].nfree -= n;
+    release(&kmem[victim].lock);
+
+    last -> next = 0;
+    kmem[cpu_id].nsteal += n;
+    if(n > 1)
+    {
+      acquire(&kmem[cpu_id].lock);
+      last -> next = kmem[cpu_id].freelist;
+      kmem[cpu_id].freelist = r -> next;
+      kmem[cpu_id].nfree += n - 1;
+      release(&kmem[cpu_id].lock);
+    }
+    return r;
+  }
+  return 0;
 }
 
 // Free the page of physical memory pointed at by pa,
@@ -107,101 +439,336 @@ kfree(void *pa)
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
-  count_decre((uint64) pa);
+  int left = count_decre((uint64) pa);
+  if(left < 0)
+    panic("kfree: refcnt");
 
-  if(count_check((uint64) pa, 0))
+  if(left == 0)
   {
+    if(pages[PA2IDX(pa)].cached)
+    {
+      pages[PA2IDX(pa)].cached = 0;
+      pagecache_drop((uint64)pa);
+    }
+#ifdef KJUNK
     // Fill with junk to catch dangling refs.
     memset(pa, 1, PGSIZE);
+#endif
     r = (struct run*)pa;
 
     push_off();
     int cpu_id = cpuid();
 
     acquire(&kmem[cpu_id].lock);
+    kmem[cpu_id].nfreed++;
     r -> next = kmem[cpu_id].freelist;
     kmem[cpu_id].freelist = r; //push_front
+    if(++kmem[cpu_id].nfree > KMEM_HIGH)
+      kmem_drain(cpu_id);
     release(&kmem[cpu_id].lock);
 
     pop_off();
   }
 }
 
+// Add n (possibly negative) to this CPU's count of
+// handed out pages.
+static void
+count_alloc(int n)
+{
+  push_off();
+  kmem[cpuid()].nalloc += n;
+  pop_off();
+}
+
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
-// Returns 0 if the memory cannot be allocated.
+// Returns 0 if the memory cannot be allocated, even after
+// reclaim() dropped some cold file pages.
 void *
 kalloc(void)
+{
+  void *pa;
+
+  if((pa = kalloc_noreclaim()) == 0 && reclaim(RECLAIMBATCH) > 0)
+    pa = kalloc_noreclaim();
+  return pa;
+}
+
+// kalloc() from the free lists only.
+static void *
+kalloc_noreclaim(void)
 {
   struct run *r;
 
   push_off();
   int cpu_id = cpuid();
   acquire(&kmem[cpu_id].lock);
+  if(kmem[cpu_id].freelist == 0)
+  {
+    //local cache is empty, refill it in a batch from the buddy lists
+    kmem_refill(cpu_id);
+  }
   r = kmem[cpu_id].freelist;
   if(r)
   {
     kmem[cpu_id].freelist = r -> next;
+    kmem[cpu_id].nfree--;
   }
-
   release(&kmem[cpu_id].lock);
 
   if(!r)
   {
-    for(int cpu_id2 = cpu_id + 1; cpu_id2 != cpu_id; cpu_id2 = (cpu_id2 + 1) % NCPU)
-    {
-      acquire(&kmem[cpu_id2].lock);
-      r = kmem[cpu_id2].freelist;
-      if(r)
-      {
-        kmem[cpu_id2].freelist = r -> next;
-        release(&kmem[cpu_id2].lock);
-        break;
-      }
-      else
-      {
-        release(&kmem[cpu_id2].lock);
-      }
-    }
+    //no free block left at all, steal from another CPU's cache
+    r = kmem_steal(cpu_id);
   }
 
   if(r)
   { 
+#ifdef KJUNK
     memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
     count_init((uint64) r, 1);
   }
+  else if((r = kzero_pop()) != 0)
+  {
+    //last resort: the pages zeroed ahead of time are free memory too
+#ifdef KJUNK
+    memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
+  }
+
+  if(r)
+    kmem[cpu_id].nalloc++;
 
   pop_off();
+
   return (void*)r;
 }
 
-uint64
-fmemory_counting(void)
+// Pop a page off the pre-zeroed pool, or return 0.
+// The page's refcount is already 1.
+static struct run *
+kzero_pop(void)
 {
   struct run *r;
-  uint64 count = 0;
 
-  //pointer r will be used to traverse the freelist
-  //and couting the number of free memory run pages
-  //stored in "count"
+  acquire(&kzero.lock);
+  r = kzero.list;
+  if(r)
+  {
+    kzero.list = r -> next;
+    kzero.n--;
+  }
+  release(&kzero.lock);
 
-  for(int cpu_id = 0; cpu_id < NCPU; cpu_id++)
+  if(r)
+    r -> next = 0; //the link is the only non-zero word
+  return r;
+}
+
+// Called by scheduler() when it found nothing to run:
+// zero one more page for kalloc_zeroed(), unless the pool
+// is already full. Returns 1 if a page was added.
+int
+kzero_idle(void)
+{
+  struct run *r;
+
+  if(atomic_read4(&kzero.n) >= KZERO_MAX)
+    return 0;
+  if((r = kalloc()) == 0)
+    return 0;
+  memset(r, 0, PGSIZE);
+
+  acquire(&kzero.lock);
+  if(kzero.n >= KZERO_MAX)
   {
+    //another idle CPU filled the pool meanwhile
+    release(&kzero.lock);
+    kfree(r);
+    return 0;
+  }
+  r -> next = kzero.list;
+  kzero.list = r;
+  kzero.n++;
+  release(&kzero.lock);
+  count_alloc(-1); //the page is still free memory
+  return 1;
+}
 
-    acquire(&kmem[cpu_id].lock);
-    //locking before accessing kmem : 
-    //many threads may be accessing kmem at the same time!
+// Allocate one zero-filled page.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_zeroed(void)
+{
+  struct run *r;
 
-    for(r = kmem[cpu_id].freelist; r != 0; r = r -> next)
-    {
-      ++count;
-    }
+  if((r = kzero_pop()) != 0)
+  {
+    count_alloc(1);
+    return (void*)r;
+  }
+  if((r = kalloc()) != 0)
+    memset(r, 0, PGSIZE);
+  return (void*)r;
+}
 
-    release(&kmem[cpu_id].lock);
+// Allocate 2^order physically contiguous pages, aligned
+// to their size. kalloc() is the order-0 special case.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_order(int order)
+{
+  char *pa;
+
+  if(order < 0 || order > MAXORDER)
+    panic("kalloc_order");
+  if(order == 0)
+    return kalloc();
+
+  if((pa = buddy_alloc(order)) == 0)
+    return 0;
+#ifdef KJUNK
+  memset(pa, 5, (uint64)PGSIZE << order); // fill with junk
+#endif
+  count_init((uint64) pa, 1); //the whole block is counted on its first page
+  count_alloc(1 << order);
+  return pa;
+}
+
+// Turn a block returned by kalloc_order() into 2^order
+// separate pages, each with the block's refcount, to be
+// freed one at a time with kfree().
+void
+ksplit(void *pa, int order)
+{
+  int ref = atomic_read4(&pages[PA2IDX(pa)].refcnt);
+
+  for(uint64 i = 1; i < (1L << order); i++)
+    count_init((uint64)pa + i * PGSIZE, ref);
+}
+
+// Free a block of 2^order pages returned by kalloc_order().
+void
+kfree_order(void *pa, int order)
+{
+  uint64 size;
+
+  if(order == 0)
+  {
+    kfree(pa);
+    return;
   }
 
+  if(order < 0 || order > MAXORDER)
+    panic("kfree_order: order");
+  size = (uint64)PGSIZE << order;
+  if((char*)pa < end || (uint64)pa + size > PHYSTOP || ((uint64)pa - KERNBASE) % size != 0)
+    panic("kfree_order");
+
+  int left = count_decre((uint64) pa);
+  if(left < 0)
+    panic("kfree_order: refcnt");
+
+  if(left == 0)
+  {
+#ifdef KJUNK
+    // Fill with junk to catch dangling refs.
+    memset(pa, 1, size);
+#endif
+    push_off();
+    kmem[cpuid()].nfreed += 1 << order;
+    pop_off();
+    buddy_free(pa, order);
+  }
+}
+
+// Number of free pages.
+static uint64
+nfreepages(void)
+{
+  uint64 count = 0;
+
+  //every free list keeps count of its pages:
+  //just add up the counters, without locking.
+  //the sum is exact only while no pages move
+  //between lists, which is good enough for sysinfo
+
+  for(int cpu_id = 0; cpu_id < NCPU; cpu_id++)
+  {
+    count += atomic_read4(&kmem[cpu_id].nfree);
+  }
+  count += atomic_read4(&buddy.nfree);
+  count += (PHYSTOP - __atomic_load_n(&buddy.unclaimed, __ATOMIC_RELAXED)) / PGSIZE;
+  count += atomic_read4(&kzero.n);
+  return count;
+}
+
+uint64
+fmemory_counting(void)
+{
+  uint64 count = nfreepages();
+  uint64 promised = atomic_read4(&reserve.n);
+
+  //reserved pages are as good as allocated
+  count = count > promised ? count - promised : 0;
+
   return count * PGSIZE;
   //count is the number of pages
   //And the return value of this function
   //is the number of bytes
-}
\ No newline at end of file
+}
+
+// Reserve npages free pages for user memory that will be
+// allocated on first touch, so that touching it later does
+// not run out of memory. Returns 0 on success, -1 if there
+// are not enough free pages left to promise.
+int
+kreserve(uint64 npages)
+{
+  uint64 free, need;
+
+  if(npages == 0)
+    return 0;
+  for(;;){
+    acquire(&reserve.lock);
+    free = nfreepages();
+    if(reserve.n + npages <= free)
+      break;
+    need = reserve.n + npages - free;
+    release(&reserve.lock);
+    //drop or swap out cold pages to make up the difference,
+    //for as long as reclaim finds any
+    if(reclaim(need) == 0)
+      return -1;
+  }
+  reserve.n += npages;
+  release(&reserve.lock);
+  return 0;
+}
+
+// Give back reservations, as their pages have been
+// allocated or are no longer needed.
+void
+kunreserve(uint64 npages)
+{
+  acquire(&reserve.lock);
+  if(npages > reserve.n)
+    panic("kunreserve");
+  reserve.n -= npages;
+  release(&reserve.lock);
+}
+
+// Copy out each CPU's allocator counters, without locking.
+void
+fmemory_stats(struct kmemstat *st)
+{
+  for(int cpu_id = 0; cpu_id < NCPU; cpu_id++)
+  {
+    st[cpu_id].nfree = atomic_read4(&kmem[cpu_id].nfree);
+    st[cpu_id].nalloc = __atomic_load_n(&kmem[cpu_id].nalloc, __ATOMIC_RELAXED);
+    st[cpu_id].nfreed = __atomic_load_n(&kmem[cpu_id].nfreed, __ATOMIC_RELAXED);
+    st[cpu_id].nsteal = __atomic_load_n(&kmem[cpu_id].nsteal, __ATOMIC_RELAXED);
+  }
+}
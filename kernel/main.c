@@ -20,16 +20,21 @@ main()
     printf("xv6 kernel is booting\n");
     printf("\n");
     kinit();         // physical page allocator
+    slabinit();      // kernel object caches
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
     procinit();      // process table
     trapinit();      // trap vectors
+    timerinit();     // kernel timers
     trapinithart();  // install kernel trap vector
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
     iinit();         // inode table
     fileinit();      // file table
+    pipeinit();      // pipe cache
+    pagecacheinit(); // shared file pages
+    reclaiminit();   // page reclaim clock
     virtio_disk_init(); // emulated hard disk
 #ifdef LAB_NET
     pci_init();
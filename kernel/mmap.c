@@ -0,0 +1,292 @@
+// Memory-mapped files.
+//
+// mmap() only records the mapping in one of the process's
+// VMAs; each page is mapped on its first touch, see
+// mmapfault(). The pages come from the page cache, so all
+// the processes that map a file share one copy of it.
+// A MAP_SHARED mapping maps the cached page itself, and
+// munmap() and exit() write its dirty pages back to the
+// file. A MAP_PRIVATE one maps it copy-on-write.
+//
+// Mappings grow down from MMAPTOP. They never share a 2 MiB
+// stretch, and so a level-0 page-table page, with the heap
+// below p->sz: fork() shares those page-table pages whole.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "fcntl.h"
+
+// Return p's mapping that va belongs to, or 0.
+struct vma*
+findvma(struct proc *p, uint64 va)
+{
+  for(struct vma *v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->f && va >= v->start && va < v->end)
+      return v;
+  }
+  return 0;
+}
+
+// The highest address p's heap may grow to.
+uint64
+heaplimit(struct proc *p)
+{
+  uint64 base = MMAPTOP;
+
+  for(struct vma *v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->f && v->start < base)
+      base = v->start;
+  }
+  if(base == MMAPTOP)
+    return TRAPFRAME - PGSIZE; //keep clear of the pages at the top
+  return SUPERPGROUNDDOWN(base);
+}
+
+// PTE flags for the pages of v.
+static int
+vmaperm(struct vma *v)
+{
+  int perm = PTE_U;
+
+  if(v->prot & (PROT_READ|PROT_WRITE))
+    perm |= PTE_R;
+  if(v->prot & PROT_EXEC)
+    perm |= PTE_X;
+  if(v->prot & PROT_WRITE)
+    perm |= (v->flags & MAP_SHARED) ? PTE_W : PTE_COW;
+  return perm;
+}
+
+// Map a file into the current process at an address of the
+// kernel's choosing. Returns the address, or -1.
+uint64
+mmap(uint64 len, int prot, int flags, struct file *f, uint64 off)
+{
+  struct proc *p = myproc();
+  struct vma *v, *free = 0;
+  uint64 top = MMAPTOP;
+
+  if(len == 0 || off % PGSIZE != 0 || f->type != FD_INODE)
+    return -1;
+  if(flags != MAP_SHARED && flags != MAP_PRIVATE)
+    return -1;
+  if(!f->readable || (flags == MAP_SHARED && (prot & PROT_WRITE) && !f->writable))
+    return -1;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->f == 0 && free == 0)
+      free = v;
+    else if(v->f && v->start < top)
+      top = v->start;
+  }
+  len = PGROUNDUP(len);
+  if(free == 0 || len > top || top - len < SUPERPGROUNDUP(p->sz))
+    return -1;
+
+  free->start = top - len;
+  free->end = top;
+  free->off = off;
+  free->prot = prot;
+  free->flags = flags;
+  free->f = filedup(f);
+  return free->start;
+}
+
+// Map the page at va of p's mapping v, reading it into the
+// page cache if needed.
+// Returns the physical address of the page, or 0.
+uint64
+mmapfault(struct proc *p, struct vma *v, uint64 va)
+{
+  struct inode *ip = v->f->ip;
+  uint64 pa;
+  int locked;
+
+  if((v->prot & (PROT_READ|PROT_WRITE|PROT_EXEC)) == 0)
+    return 0;
+  va = PGROUNDDOWN(va);
+
+  push_off();
+  locked = mycpu()->noff > 1;
+  pop_off();
+  if(locked)
+    return 0; //see loadpage()
+  locked = holdingsleep(&ip->lock);
+  if(!locked)
+    ilock(ip);
+  pa = pagecache_get(ip, v->off + (va - v->start));
+  if(!locked)
+    iunlock(ip);
+  if(pa == 0)
+    return 0;
+
+  // counts as used, so that reclaim() leaves it for a while
+  if(mappages(p->pagetable, va, PGSIZE, pa, vmaperm(v) | PTE_A) != 0){
+    kfree((void*)pa);
+    return 0;
+  }
+  return pa;
+}
+
+// Write the dirty pages of v in [start, end) back to the
+// file, if v is a writable MAP_SHARED mapping. Nothing past
+// the end of the file is written.
+static void
+writeback(struct proc *p, struct vma *v, uint64 start, uint64 end)
+{
+  struct inode *ip = v->f->ip;
+  pte_t *pte;
+  uint64 a, off;
+  int level;
+  uint n;
+
+  if(v->flags != MAP_SHARED || (v->prot & PROT_WRITE) == 0)
+    return;
+  for(a = start; a < end; a += PGSIZE){
+    pte = walkleaf(p->pagetable, a, &level);
+    if(pte == 0 || (*pte & PTE_D) == 0)
+      continue;
+    off = v->off + (a - v->start);
+    begin_op();
+    ilock(ip);
+    if(off < ip->size){
+      n = ip->size - off < PGSIZE ? ip->size - off : PGSIZE;
+      writei(ip, 0, PTE2PA(*pte), off, n);
+    }
+    iunlock(ip);
+    end_op();
+  }
+}
+
+// Remove [start, end), which must lie within v, from p's
+// mapping v. What is left of v may be split in two.
+// Caller must make sure there is a free VMA for the split.
+static void
+vmaunmap(struct proc *p, struct vma *v, uint64 start, uint64 end)
+{
+  struct vma *w;
+  struct file *f;
+
+  writeback(p, v, start, end);
+  //mapped pages were never reserved, so the holes don't count
+  uvmunmap(p->pagetable, start, (end - start) / PGSIZE, 1);
+
+  if(start == v->start && end == v->end){
+    f = v->f;
+    v->f = 0;
+    fileclose(f);
+  } else if(start == v->start){
+    v->off += end - v->start;
+    v->start = end;
+  } else if(end == v->end){
+    v->end = start;
+  } else {
+    for(w = p->vma; w->f; w++)
+      ;
+    *w = *v;
+    w->off = v->off + (end - v->start);
+    w->start = end;
+    filedup(w->f);
+    v->end = start;
+  }
+}
+
+// Remove the mappings of the current process in
+// [addr, addr+len). Returns 0, or -1 if addr is not
+// page-aligned or a mapping would have to be split with no
+// VMA free.
+int
+munmap(uint64 addr, uint64 len)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint64 end = addr + PGROUNDUP(len);
+  int nfree = 0;
+
+  if(addr % PGSIZE != 0 || end < addr)
+    return -1;
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->f == 0)
+      nfree++;
+  }
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->f && v->start < addr && end < v->end && nfree == 0)
+      return -1;
+  }
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->f == 0 || end <= v->start || addr >= v->end)
+      continue;
+    vmaunmap(p, v, addr > v->start ? addr : v->start, end < v->end ? end : v->end);
+  }
+  return 0;
+}
+
+// Remove all of p's mappings, as exit() and exec() do.
+void
+munmapall(struct proc *p)
+{
+  for(struct vma *v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->f)
+      vmaunmap(p, v, v->start, v->end);
+  }
+}
+
+// Give the new process np the mappings of the current
+// process p, for fork(). Pages p has mapped are shared with
+// np: those of MAP_SHARED mappings as they are, MAP_PRIVATE
+// ones copy-on-write. Private pages that went out to swap
+// are read back in first.
+// Returns 0, or -1 if out of memory.
+int
+mmapcopy(struct proc *p, struct proc *np)
+{
+  struct vma *v, *nv;
+  pte_t *pte;
+  uint64 a;
+  int level;
+
+  for(v = p->vma, nv = np->vma; v < &p->vma[NVMA]; v++, nv++){
+    nv->f = 0;
+    if(v->f == 0)
+      continue;
+    for(a = v->start; a < v->end; a += PGSIZE){
+      if(uvmswapped(p->pagetable, a) && lazyfault(p->pagetable, a, 0) == 0){
+        uvmunmap(np->pagetable, v->start, (a - v->start) / PGSIZE, 1);
+        goto bad;
+      }
+      if((pte = walkleaf(p->pagetable, a, &level)) == 0)
+        continue;
+      if(v->flags == MAP_PRIVATE && (*pte & PTE_W)){
+        *pte &= ~PTE_W;
+        *pte |= PTE_COW;
+      }
+      if(mappages(np->pagetable, a, PGSIZE, PTE2PA(*pte), PTE_FLAGS(*pte) & ~PTE_V) != 0){
+        uvmunmap(np->pagetable, v->start, (a - v->start) / PGSIZE, 1);
+        goto bad;
+      }
+      count_incre(PTE2PA(*pte));
+    }
+    *nv = *v;
+    filedup(nv->f);
+  }
+  return 0;
+
+ bad:
+  for(nv = np->vma; nv < &np->vma[NVMA]; nv++){
+    if(nv->f){
+      uvmunmap(np->pagetable, nv->start, (nv->end - nv->start) / PGSIZE, 1);
+      fileclose(nv->f);
+      nv->f = 0;
+    }
+  }
+  return -1;
+}
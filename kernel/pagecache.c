@@ -0,0 +1,204 @@
+// Page cache for file pages that several address spaces can
+// map at once, such as the text of a program that runs in
+// many processes.
+//
+// A cached page is identified by (dev, inum, offset). The
+// cache does not hold a reference to its pages: an entry
+// lives only as long as some page table maps the page, and
+// kfree() drops it when the last reference goes away. So the
+// cache never keeps memory busy by itself.
+//
+// writei() copies what it writes into the cached page as
+// well, and itrunc() zeroes the cached pages of the file, so
+// a page in the cache always holds the file's contents, and
+// everyone who maps it sees the changes. The file of a
+// running program can't be written or truncated at all, so
+// its text never changes under it; see iexecdup().
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+
+#define NPCHASH 61
+
+struct cpage {
+  uint dev;
+  uint inum;
+  uint off;                 // page-aligned file offset
+  uint64 pa;                // the page
+  struct cpage *next;       // hash chain by (dev, inum, off)
+  struct cpage *panext;     // hash chain by pa
+};
+
+struct {
+  struct spinlock lock;
+  struct kmem_cache *cache;
+  struct cpage *hash[NPCHASH];
+  struct cpage *pahash[NPCHASH];
+  int n;                    // number of entries
+} pcache;
+
+#define KEYHASH(dev, inum, off) (((dev) * 31 + (inum) * 17 + (off) / PGSIZE) % NPCHASH)
+#define PAHASH(pa) (((pa) / PGSIZE) % NPCHASH)
+
+void
+pagecacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+  pcache.cache = kmem_cache_create("cpage", sizeof(struct cpage));
+}
+
+// Unlink c from both hash chains.
+// Caller must hold pcache.lock.
+static void
+pc_unlink(struct cpage *c)
+{
+  struct cpage **pp;
+
+  for(pp = &pcache.hash[KEYHASH(c->dev, c->inum, c->off)]; *pp != c; pp = &(*pp)->next)
+    ;
+  *pp = c->next;
+  for(pp = &pcache.pahash[PAHASH(c->pa)]; *pp != c; pp = &(*pp)->panext)
+    ;
+  *pp = c->panext;
+  pcache.n--;
+}
+
+// Look up page off of ip and take a reference to it.
+// Returns 0 if it is not cached, or is being freed.
+// Caller must hold pcache.lock.
+static uint64
+pc_lookup(uint dev, uint inum, uint off)
+{
+  struct cpage *c;
+
+  for(c = pcache.hash[KEYHASH(dev, inum, off)]; c; c = c->next){
+    if(c->dev == dev && c->inum == inum && c->off == off && count_tryincre(c->pa))
+      return c->pa;
+  }
+  return 0;
+}
+
+// Return the page at offset off of ip, with a reference for
+// the caller, reading it in if it is not cached.
+// off must be page-aligned. The part of the page past the
+// end of the file reads as zeroes. Caller must hold
+// ip->lock.
+// Returns 0 if memory ran out or the read failed.
+uint64
+pagecache_get(struct inode *ip, uint off)
+{
+  struct cpage *c;
+  uint64 pa, cached;
+  uint n;
+
+  acquire(&pcache.lock);
+  pa = pc_lookup(ip->dev, ip->inum, off);
+  release(&pcache.lock);
+  if(pa)
+    return pa;
+
+  if((pa = (uint64)kalloc()) == 0)
+    return 0;
+  n = off < ip->size ? ip->size - off : 0;
+  if(n > PGSIZE)
+    n = PGSIZE;
+  if(readi(ip, 0, pa, off, n) != n){
+    kfree((void*)pa);
+    return 0;
+  }
+  memset((char*)pa + n, 0, PGSIZE - n);
+  if((c = kmem_cache_alloc(pcache.cache)) == 0)
+    return pa; // no room to share it, the caller gets a private copy
+
+  acquire(&pcache.lock);
+  if((cached = pc_lookup(ip->dev, ip->inum, off)) != 0){
+    // someone else read it in meanwhile
+    release(&pcache.lock);
+    kmem_cache_free(pcache.cache, c);
+    kfree((void*)pa);
+    return cached;
+  }
+  c->dev = ip->dev;
+  c->inum = ip->inum;
+  c->off = off;
+  c->pa = pa;
+  c->next = pcache.hash[KEYHASH(c->dev, c->inum, off)];
+  pcache.hash[KEYHASH(c->dev, c->inum, off)] = c;
+  c->panext = pcache.pahash[PAHASH(pa)];
+  pcache.pahash[PAHASH(pa)] = c;
+  pcache.n++;
+  count_setcached(pa);
+  release(&pcache.lock);
+  return pa;
+}
+
+// Called by kfree() when the last reference to a page
+// marked cached is dropped.
+void
+pagecache_drop(uint64 pa)
+{
+  struct cpage *c;
+
+  acquire(&pcache.lock);
+  for(c = pcache.pahash[PAHASH(pa)]; c; c = c->panext){
+    if(c->pa == pa)
+      break;
+  }
+  if(c)
+    pc_unlink(c);
+  release(&pcache.lock);
+  if(c)
+    kmem_cache_free(pcache.cache, c);
+}
+
+// Copy the n bytes at src, just written to file (dev, inum)
+// at off, into the cached page, if there is one. They must
+// not cross a page boundary.
+void
+pagecache_write(uint dev, uint inum, uint off, char *src, uint n)
+{
+  struct cpage *c;
+  uint a = PGROUNDDOWN(off);
+
+  if(atomic_read4(&pcache.n) == 0 || n == 0)
+    return;
+
+  // a page on its way out is not reused before kfree()
+  // gets past pagecache_drop(), which waits for the lock.
+  acquire(&pcache.lock);
+  for(c = pcache.hash[KEYHASH(dev, inum, a)]; c; c = c->next){
+    if(c->dev == dev && c->inum == inum && c->off == a){
+      memmove((char*)c->pa + (off - a), src, n);
+      break;
+    }
+  }
+  release(&pcache.lock);
+}
+
+// Zero the cached pages of file (dev, inum), which has been
+// truncated. Those who map them keep them, and see the file
+// as it is now.
+void
+pagecache_trunc(uint dev, uint inum)
+{
+  struct cpage *c;
+
+  if(atomic_read4(&pcache.n) == 0)
+    return;
+
+  acquire(&pcache.lock);
+  for(int i = 0; i < NPCHASH; i++){
+    for(c = pcache.hash[i]; c; c = c->next){
+      if(c->dev == dev && c->inum == inum)
+        memset((void*)c->pa, 0, PGSIZE);
+    }
+  }
+  release(&pcache.lock);
+}
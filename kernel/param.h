@@ -5,11 +5,12 @@
 #endif
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // maximum number of unused i-nodes kept cached
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
+#define NSEG          4  // max ELF load segments in a program
+#define NVMA         16  // max mmap()ed regions per process
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
@@ -22,6 +23,10 @@
 #define FSSIZE       2000   // size of file system in blocks
 #endif
 #endif
+#define SWAPSIZE     16384 // size of swap area in blocks, after the file system
 #define MAXPATH      128   // maximum file path name
+#define MAXORDER       9   // largest kalloc_order() block, 2^9 pages (2 MiB)
+#define CLOCKINTERVAL 1000000 // cycles between clock interrupts; about 1/10th second in qemu
+#define NSCRATCH       7   // words of timer_scratch[] per CPU, see start.c
 
 
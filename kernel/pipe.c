@@ -8,7 +8,7 @@
 #include "sleeplock.h"
 #include "file.h"
 
-#define PIPESIZE 512
+#define PIPESIZE 2048
 
 struct pipe {
   struct spinlock lock;
@@ -19,6 +19,14 @@ struct pipe {
   int writeopen;  // write fd is still open
 };
 
+struct kmem_cache *pipecache;
+
+void
+pipeinit(void)
+{
+  pipecache = kmem_cache_create("pipe", sizeof(struct pipe));
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -28,7 +36,7 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((pi = (struct pipe*)kalloc()) == 0)
+  if((pi = (struct pipe*)kmem_cache_alloc(pipecache)) == 0)
     goto bad;
   pi->readopen = 1;
   pi->writeopen = 1;
@@ -47,7 +55,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(pi)
-    kfree((char*)pi);
+    kmem_cache_free(pipecache, pi);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -71,7 +79,7 @@ pipeclose(struct pipe *pi, int writable)
 #ifdef LAB_LOCK
     freelock(&pi->lock);
 #endif    
-    kfree((char*)pi);
+    kmem_cache_free(pipecache, pi);
   } else
     release(&pi->lock);
 }
@@ -92,11 +100,16 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
       wakeup(&pi->nread);
       sleep(&pi->nwrite, &pi->lock);
     } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+      // as much as fits before the end of data[]
+      int m = n - i;
+      if(m > PIPESIZE - (pi->nwrite - pi->nread))
+        m = PIPESIZE - (pi->nwrite - pi->nread);
+      if(m > PIPESIZE - pi->nwrite % PIPESIZE)
+        m = PIPESIZE - pi->nwrite % PIPESIZE;
+      if(copyin(pr->pagetable, &pi->data[pi->nwrite % PIPESIZE], addr + i, m) == -1)
         break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      pi->nwrite += m;
+      i += m;
     }
   }
   wakeup(&pi->nread);
@@ -108,9 +121,8 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
 int
 piperead(struct pipe *pi, uint64 addr, int n)
 {
-  int i;
+  int i, m;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
   while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
@@ -120,12 +132,18 @@ piperead(struct pipe *pi, uint64 addr, int n)
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
+  for(i = 0; i < n; i += m){  //DOC: piperead-copy
     if(pi->nread == pi->nwrite)
       break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+    // as much as is there before the end of data[]
+    m = n - i;
+    if(m > pi->nwrite - pi->nread)
+      m = pi->nwrite - pi->nread;
+    if(m > PIPESIZE - pi->nread % PIPESIZE)
+      m = PIPESIZE - pi->nread % PIPESIZE;
+    if(copyout(pr->pagetable, addr + i, &pi->data[pi->nread % PIPESIZE], m) == -1)
       break;
+    pi->nread += m;
   }
   wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
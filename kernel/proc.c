@@ -12,11 +12,16 @@ struct proc proc[NPROC];
 
 struct proc *initproc;
 
+// backup trapframes for sigalarm handlers need not be a page each
+struct kmem_cache *tfcache;
+
 int nextpid = 1;
 struct spinlock pid_lock;
 
 extern void forkret(void);
 static void freeproc(struct proc *p);
+static void makerunnable(struct proc *p);
+static void kick(struct cpu *c);
 
 extern char trampoline[]; // trampoline.S
 
@@ -26,6 +31,20 @@ extern char trampoline[]; // trampoline.S
 // must be acquired before any p->lock.
 struct spinlock wait_lock;
 
+// Sleeping processes, on hash chains by the channel they
+// sleep on, so that wakeup() only looks at those that may
+// be waiting for it. A process is on its channel's queue
+// exactly while it is SLEEPING. A queue's lock must be
+// acquired before the p->lock of the processes on it.
+#define NWAITQ 61
+
+struct waitq {
+  struct spinlock lock;
+  struct proc *head;
+} waitq[NWAITQ];
+
+#define WAITQ(chan) (&waitq[((uint64)(chan) >> 3) % NWAITQ])
+
 // Allocate a page for each process's kernel stack.
 // Map it high in memory, followed by an invalid
 // guard page.
@@ -51,6 +70,11 @@ procinit(void)
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&cpus[i].rqlock, "runq");
+  for(int i = 0; i < NWAITQ; i++)
+    initlock(&waitq[i].lock, "waitq");
+  tfcache = kmem_cache_create("trapframe", sizeof(struct trapframe));
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
       p->state = UNUSED;
@@ -125,6 +149,10 @@ allocproc(void)
 found:
   p->pid = allocpid();
   p->state = USED;
+  p->cpu = cpuid(); // the creator's, to start with
+  p->nice = 0;
+  p->runtime = 0;
+  p->vruntime = cpus[p->cpu].minvruntime;
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
@@ -165,8 +193,9 @@ found:
   p -> ticks_count = -1;
   p -> is_handler = 0;
 
-  if((p -> backup_trapframe = (struct trapframe * )kalloc()) == 0)
+  if((p -> backup_trapframe = (struct trapframe * )kmem_cache_alloc(tfcache)) == 0)
   {
+    freeproc(p);
     release(&p -> lock);
     return 0;
   }
@@ -199,12 +228,16 @@ freeproc(struct proc *p)
 
   if(p -> backup_trapframe)
   {
-    kfree((void*)p -> backup_trapframe);
+    kmem_cache_free(tfcache, p -> backup_trapframe);
   }
   p -> backup_trapframe = 0;
 
   p->pagetable = 0;
   p->sz = 0;
+  p->nseg = 0;
+  p->wss = 0;
+  p->wsacc = 0;
+  p->pinned = 0;
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
@@ -309,12 +342,14 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  makerunnable(p);
 
   release(&p->lock);
 }
 
 // Grow or shrink user memory by n bytes.
+// Growing only reserves memory: the pages are allocated
+// and mapped on first touch, see uvmlazy().
 // Return 0 on success, -1 on failure.
 int
 growproc(int n)
@@ -324,9 +359,11 @@ growproc(int n)
 
   sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+    if(sz + n > heaplimit(p)) //keep clear of mmap() and the pages at the top
       return -1;
-    }
+    if(kreserve((PGROUNDUP(sz + n) - PGROUNDUP(sz)) / PGSIZE) < 0)
+      return -1;
+    sz += n;
   } else if(n < 0){
     sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
@@ -347,19 +384,31 @@ fork(void)
   if((np = allocproc()) == 0){
     return -1;
   }
+  // nobody else looks at np while it is USED, and without
+  // its lock held kalloc() and kreserve() may reclaim pages
+  // from other processes for the copy.
+  release(&np->lock);
 
   // Copy user memory from parent to child.
   if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+    acquire(&np->lock);
     freeproc(np);
     release(&np->lock);
     return -1;
   }
   np->sz = p->sz;
+  if(mmapcopy(p, np) < 0){
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
 
   np -> mask_num = p -> mask_num;
+  np->nice = p->nice;
   //Copy the mask_num from parent to child
   //Used for the system call "trace"
 
@@ -371,19 +420,77 @@ fork(void)
     if(p->ofile[i])
       np->ofile[i] = filedup(p->ofile[i]);
   np->cwd = idup(p->cwd);
+  if(p->exe)
+    np->exe = iexecdup(p->exe);
+  memmove(np->seg, p->seg, sizeof(p->seg));
+  np->nseg = p->nseg;
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
   pid = np->pid;
 
+  acquire(&wait_lock);
+  np->parent = p;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  makerunnable(np);
   release(&np->lock);
 
+  return pid;
+}
+
+// Create a new process running the program path with
+// arguments argv, like fork() followed by exec() in the
+// child, but the parent's memory is never copied: the
+// child's image is built straight into its new page table.
+// The child gets the parent's open files, or, if files is
+// not 0, only files[0], files[1] and files[2] (which may be
+// 0) as its file descriptors 0, 1 and 2.
+// Returns the child's pid, or -1 if path cannot be run.
+int
+spawn(char *path, char **argv, struct file **files)
+{
+  int i, pid, argc;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  // Allocate process.
+  if((np = allocproc()) == 0){
+    return -1;
+  }
+  // kexec() sleeps. Nobody else touches np while it is
+  // USED, as in the second half of fork().
+  release(&np->lock);
+
+  memset(np->trapframe, 0, sizeof(*np->trapframe));
+  if((argc = kexec(np, path, argv)) < 0){
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  np->trapframe->a0 = argc;
+
+  np -> mask_num = p -> mask_num;
+  np->nice = p->nice;
+
+  for(i = 0; i < NOFILE; i++){
+    if(files == 0 && p->ofile[i])
+      np->ofile[i] = filedup(p->ofile[i]);
+    else if(files != 0 && i < 3 && files[i])
+      np->ofile[i] = filedup(files[i]);
+  }
+  np->cwd = idup(p->cwd);
+
+  pid = np->pid;
+
   acquire(&wait_lock);
   np->parent = p;
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  makerunnable(np);
   release(&np->lock);
 
   return pid;
@@ -415,6 +522,9 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
+  // Write back and drop mmap()ed files.
+  munmapall(p);
+
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
@@ -426,8 +536,11 @@ exit(int status)
 
   begin_op();
   iput(p->cwd);
+  if(p->exe)
+    iexecput(p->exe);
   end_op();
   p->cwd = 0;
+  p->exe = 0;
 
   acquire(&wait_lock);
 
@@ -458,6 +571,10 @@ wait(uint64 addr)
   int havekids, pid;
   struct proc *p = myproc();
 
+  // the status is copied out with locks held.
+  if(addr != 0)
+    loadrange(p, addr, sizeof(int));
+
   acquire(&wait_lock);
 
   for(;;){
@@ -498,10 +615,175 @@ wait(uint64 addr)
   }
 }
 
+// The share of the CPU a process gets is proportional to the
+// weight of its nice value, -20 (most) to 19 (least); each
+// step is worth about 10% of CPU time against a process at
+// nice 0, whose weight is NICE0WEIGHT.
+#define NICE0WEIGHT 1024
+
+static const int niceweight[40] = {
+  /* -20 */ 88761, 71755, 56483, 46273, 36291,
+  /* -15 */ 29154, 23254, 18705, 14949, 11916,
+  /* -10 */ 9548, 7620, 6100, 4904, 3906,
+  /*  -5 */ 3121, 2501, 1991, 1586, 1277,
+  /*   0 */ 1024, 820, 655, 526, 423,
+  /*   5 */ 335, 272, 215, 172, 137,
+  /*  10 */ 110, 87, 70, 56, 45,
+  /*  15 */ 36, 29, 23, 18, 15,
+};
+
+// How far behind the CPU's least virtual runtime a process
+// that wakes up may be placed: it runs soon, but cannot
+// make up for all the time it slept.
+#define WAKEUPCREDIT CLOCKINTERVAL
+
+// Charge the running process p for the time since it last
+// started running, in real and in virtual time. Virtual
+// time runs slower the higher p's weight.
+// Caller must hold p->lock.
+static void
+charge(struct proc *p)
+{
+  uint64 now = *(uint64*)CLINT_MTIME;
+  uint64 delta = now - p->lastrun;
+
+  p->runtime += delta;
+  p->vruntime += delta * NICE0WEIGHT / niceweight[p->nice + 20];
+  p->lastrun = now;
+}
+
+// Mark p RUNNABLE and put it on the run queue of p->cpu,
+// the CPU it last ran on. The queue is kept sorted by
+// virtual runtime, so the process that has had least of
+// its share runs first.
+// Caller must hold p->lock.
+static void
+makerunnable(struct proc *p)
+{
+  struct cpu *c = &cpus[p->cpu];
+  struct proc **pp;
+
+  if(!holding(&p->lock))
+    panic("makerunnable");
+  acquire(&c->rqlock);
+  if(p->state == SLEEPING && p->vruntime + WAKEUPCREDIT < c->minvruntime)
+    p->vruntime = c->minvruntime - WAKEUPCREDIT;
+  p->state = RUNNABLE;
+  for(pp = &c->rqhead; *pp && (*pp)->vruntime <= p->vruntime; pp = &(*pp)->rqnext)
+    ;
+  p->rqnext = *pp;
+  *pp = p;
+  c->nrunnable++;
+  release(&c->rqlock);
+  kick(c);
+}
+
+// If c is idle, or else another CPU is, interrupt it so
+// that it looks at the run queues again. An idle CPU that
+// is not c will steal from c.
+static void
+kick(struct cpu *c)
+{
+  struct cpu *o;
+
+  if(!atomic_read4(&c->idle)){
+    for(o = cpus; o < &cpus[NCPU] && !atomic_read4(&o->idle); o++)
+      ;
+    if(o == &cpus[NCPU])
+      return;
+    c = o;
+  }
+  if(c != mycpu())
+    ipi(c - cpus);
+}
+
+// Is anything on any run queue?
+static int
+anyrunnable(void)
+{
+  for(struct cpu *c = cpus; c < &cpus[NCPU]; c++){
+    if(atomic_read4(&c->nrunnable) > 0)
+      return 1;
+  }
+  return 0;
+}
+
+// Wait for an interrupt, with this CPU's clock stopped,
+// until kick() or a device wakes it.
+static void
+idle(struct cpu *c)
+{
+  intr_off();
+  c->idle = 1;
+  // makerunnable() queues first and then looks at idle;
+  // this CPU says it is idle first and then looks at the
+  // queues. So one of them sees the other.
+  __sync_synchronize();
+  if(!anyrunnable()){
+    clockoff();
+    // returns once an interrupt is pending, which is
+    // taken when the scheduler turns interrupts on.
+    wfi();
+    clockon();
+  }
+  c->idle = 0;
+  __sync_synchronize();
+}
+
+// Take the process with the least virtual runtime off c's
+// run queue, or return 0 if it is empty.
+static struct proc*
+dequeue(struct cpu *c)
+{
+  struct proc *p;
+
+  if(atomic_read4(&c->nrunnable) == 0)
+    return 0;
+  acquire(&c->rqlock);
+  if((p = c->rqhead) != 0){
+    c->rqhead = p->rqnext;
+    c->nrunnable--;
+    if(p->vruntime > c->minvruntime)
+      c->minvruntime = p->vruntime;
+  }
+  release(&c->rqlock);
+  return p;
+}
+
+// Choose a process for c to run: the next one on its own
+// run queue, else one stolen from the longest of the other
+// CPUs' queues. Returns 0 if nothing is runnable.
+static struct proc*
+pickproc(struct cpu *c)
+{
+  struct cpu *busiest;
+  struct proc *p;
+  int n;
+
+  if((p = dequeue(c)) != 0)
+    return p;
+  for(;;){
+    busiest = 0;
+    n = 0;
+    for(struct cpu *o = cpus; o < &cpus[NCPU]; o++){
+      if(o != c && atomic_read4(&o->nrunnable) > n){
+        n = atomic_read4(&o->nrunnable);
+        busiest = o;
+      }
+    }
+    if(busiest == 0)
+      return 0;
+    if((p = dequeue(busiest)) != 0)
+      return p;
+    // emptied meanwhile; look again
+  }
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - choose a process to run, from this CPU's run queue
+//    or another's.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
@@ -518,22 +800,40 @@ scheduler(void)
     // processes are waiting.
     intr_on();
 
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
-      release(&p->lock);
+    if((p = pickproc(c)) == 0){
+      // Nothing to run: use the idle time to zero a page
+      // for kalloc_zeroed(), and once there is nothing
+      // left to do, wait for an interrupt.
+      if(!kzero_idle())
+        idle(c);
+      continue;
+    }
+
+    // Waits until the CPU that queued p, if p yielded, is
+    // done switching away from it.
+    acquire(&p->lock);
+    if(p->state != RUNNABLE)
+      panic("scheduler: not runnable");
+    if(p->cpu != c - cpus){
+      // stolen: keep its lead or lag on the old CPU's
+      // virtual clock
+      struct cpu *o = &cpus[p->cpu];
+      uint64 lag = p->vruntime > o->minvruntime ? p->vruntime - o->minvruntime : 0;
+      p->vruntime = c->minvruntime + lag;
+      p->cpu = c - cpus;
     }
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    p->state = RUNNING;
+    p->lastrun = *(uint64*)CLINT_MTIME;
+    c->proc = p;
+    swtch(&c->context, &p->context);
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
+    release(&p->lock);
   }
 }
 
@@ -570,7 +870,8 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  charge(p);
+  makerunnable(p);
   sched();
   release(&p->lock);
 }
@@ -605,20 +906,28 @@ void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct waitq *q = WAITQ(chan);
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Once we are on chan's queue, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // (wakeup locks the queue, and then p->lock,
+  // which we hold until sched() is done with p),
   // so it's okay to release lk.
 
+  acquire(&q->lock);
   acquire(&p->lock);  //DOC: sleeplock1
-  release(lk);
 
   // Go to sleep.
+  charge(p);
   p->chan = chan;
   p->state = SLEEPING;
+  p->wqnext = q->head;
+  q->head = p;
+
+  release(lk);
+  release(&q->lock);
 
   sched();
 
@@ -635,17 +944,69 @@ sleep(void *chan, struct spinlock *lk)
 void
 wakeup(void *chan)
 {
-  struct proc *p;
+  struct waitq *q = WAITQ(chan);
+  struct proc *p, **pp;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p != myproc()){
+  acquire(&q->lock);
+  for(pp = &q->head; (p = *pp) != 0; ){
+    if(p->chan == chan){
       acquire(&p->lock);
-      if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
-      }
+      *pp = p->wqnext;
+      makerunnable(p);
+      release(&p->lock);
+    } else {
+      pp = &p->wqnext;
+    }
+  }
+  release(&q->lock);
+}
+
+// Wake p if it is still asleep on chan.
+// Must be called without any p->lock.
+static void
+wakeproc(struct proc *p, void *chan)
+{
+  struct waitq *q = WAITQ(chan);
+  struct proc **pp;
+
+  acquire(&q->lock);
+  acquire(&p->lock);
+  if(p->state == SLEEPING && p->chan == chan){
+    for(pp = &q->head; *pp != p; pp = &(*pp)->wqnext)
+      ;
+    *pp = p->wqnext;
+    makerunnable(p);
+  }
+  release(&p->lock);
+  release(&q->lock);
+}
+
+// Set the nice value of the process with the given pid, or
+// of the caller if pid is 0, clamped to -20..19. It takes
+// effect from the next time the process is charged for
+// running.
+// Returns 0, or -1 if there is no such process.
+int
+setpriority(int pid, int nice)
+{
+  struct proc *p;
+
+  if(nice < -20)
+    nice = -20;
+  if(nice > 19)
+    nice = 19;
+  if(pid == 0)
+    pid = myproc()->pid;
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->pid == pid && p->state != UNUSED && p->state != ZOMBIE){
+      p->nice = nice;
       release(&p->lock);
+      return 0;
     }
+    release(&p->lock);
   }
+  return -1;
 }
 
 // Kill the process with the given pid.
@@ -655,16 +1016,19 @@ int
 kill(int pid)
 {
   struct proc *p;
+  void *chan;
 
   for(p = proc; p < &proc[NPROC]; p++){
     acquire(&p->lock);
     if(p->pid == pid){
       p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
-      }
+      chan = p->state == SLEEPING ? p->chan : 0;
       release(&p->lock);
+      if(chan){
+        // Wake process from sleep(). Its queue's lock
+        // comes before p->lock.
+        wakeproc(p, chan);
+      }
       return 0;
     }
     release(&p->lock);
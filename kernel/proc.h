@@ -24,6 +24,13 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+
+  // Run queue of RUNNABLE processes, see makerunnable().
+  struct spinlock rqlock;
+  struct proc *rqhead;        // rqlock must be held when using these
+  int nrunnable;              // length of the queue; read without rqlock
+  uint64 minvruntime;         // virtual runtime of the last process taken off it
+  int idle;                   // waiting for an interrupt in scheduler()
 };
 
 extern struct cpu cpus[NCPU];
@@ -81,6 +88,41 @@ struct trapframe {
 
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// An ELF load segment whose pages are read from the
+// executable on first touch; see exec().
+struct execseg {
+  uint64 start;     // first page of the segment's memory
+  uint64 end;       // end of the segment's memory
+  uint64 vaddr;     // where the file contents start
+  uint64 off;       // file offset of the contents
+  uint64 filesz;    // bytes of file contents; the rest is zeroes
+  int perm;         // PTE flags of the pages
+};
+
+// A file mapped by mmap(). Its pages are mapped on first
+// touch; see mmapfault().
+struct vma {
+  uint64 start;     // page-aligned
+  uint64 end;
+  uint64 off;       // file offset of start
+  int prot;         // PROT_* from fcntl.h
+  int flags;        // MAP_SHARED or MAP_PRIVATE
+  struct file *f;   // 0 if the slot is free
+};
+
+// A kernel timer, see timer.c. fn and period are set by
+// the owner before timer_add(); the rest belongs to the
+// timer wheel.
+struct timer {
+  void (*fn)(struct timer*);  // called when the timer fires
+  void *arg;                  // for fn
+  uint period;                // restart after firing if non-zero
+  uint expires;               // tick it fires at
+  int pending;                // on the wheel
+  struct timer *next;         // on the wheel's slot
+  struct timer **pprev;
+};
+
 // Per-process state
 struct proc {
   struct spinlock lock;
@@ -94,10 +136,23 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int cpu;                     // CPU whose run queue it goes on
+  int nice;                    // -20..19, see setpriority()
+  uint64 runtime;              // Time it has run, in clock cycles
+  uint64 vruntime;             // Time it has run, weighted by nice
+  uint64 lastrun;              // When it last started running
+  uint64 wss;                  // Working set: pages used during the last clock sweep
+  uint64 wsacc;                // Pages found used so far in this sweep
 
   // wait_lock must be held when using this:
   struct proc *parent;         // Parent process
 
+  // the run queue's rqlock must be held when using this:
+  struct proc *rqnext;         // Next RUNNABLE process on the queue
+
+  // the wait queue's lock must be held when using this:
+  struct proc *wqnext;         // Next process sleeping on the queue
+
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
@@ -106,6 +161,12 @@ struct proc {
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct inode *exe;           // Executable the segments come from
+  struct execseg seg[NSEG];    // Segments not necessarily loaded yet
+  int nseg;
+  struct vma vma[NVMA];        // mmap()ed files
+  int pinned;                  // reclaim() must leave the pages alone
+  struct timer timer;          // for sleep() system calls
   char name[16];               // Process name (debugging)
 
   uint64 mask_num;             // mask number used in trace system call
@@ -0,0 +1,285 @@
+// Working-set tracking and page reclaim.
+//
+// A clock ("second chance") hand sweeps the page tables of
+// all processes, a few PTEs at a time, and looks at the
+// accessed bit (PTE_A) the hardware sets whenever a page
+// is used. A page whose bit is set gets it cleared, and
+// counts in its process's working set: p->wss is the
+// number of pages the process used between the last two
+// passes of the hand. A page whose bit is still clear when
+// the hand comes round again is cold.
+//
+// The hand moves on every clock tick, and reclaim() moves
+// it faster when kalloc() or kreserve() run short. Cold
+// pages that can be read back from a file are then dropped:
+// clean pages of the page cache (program text, mmap()ed
+// files), and pages of read-only program segments. Cold
+// anonymous pages that only one process maps go out to
+// swap, see swap.c; cold megapages are split up for that.
+// Either way the PTE is left marked PTE_DROPPED, so that a
+// later touch faults the page back in, see lazyfault().
+// Only reclaim() swaps, since it must wait for the disk
+// after the hand has stopped.
+//
+// The hand only stops at processes that are not running,
+// with their p->lock held, so that their page tables do not
+// change underneath it; they flush their TLBs on their way
+// back to user space. The current process is aged too.
+// Pages are only dropped from sleeping processes, as one
+// that is runnable may have been preempted in the middle of
+// using one, and not from those a system call pinned, see
+// loadrange(). Page-table pages that fork() left shared are
+// aged but never dropped from.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "fcntl.h"
+
+#define AGEBATCH  512     // PTEs the hand looks at per clock tick
+#define LOWMEM    64      // reclaim on a tick if fewer pages are free
+#define LOWBATCH  32      // pages to free then
+#define NOLIMIT   (1 << 30)
+#define NVICTIM   32      // pages reclaim() swaps out per call
+
+// Swap slots of the pages the hand picked, to be written
+// out once it has stopped.
+struct victims {
+  int n;
+  int slot[NVICTIM];
+};
+
+extern struct proc proc[NPROC];
+
+struct {
+  struct spinlock lock;
+  int i;                    // the hand: the process in proc[]
+  uint64 va;                //   and the next address in it
+  uint aged;                // tick the hand last moved on
+  uint64 nreclaimed;        // pages freed by reclaim
+} clock;
+
+void
+reclaiminit(void)
+{
+  initlock(&clock.lock, "clock");
+}
+
+// The first address past the level-sized region of va.
+static uint64
+nextregion(uint64 va, int level)
+{
+  return ((va >> PXSHIFT(level)) + 1) << PXSHIFT(level);
+}
+
+// Can the cold page of p at va, mapped by pte in a page
+// table p does not share, be read back later instead?
+static int
+reclaimable(struct proc *p, uint64 va, pte_t pte)
+{
+  struct execseg *s;
+
+  if((pte & PTE_D) || iszeropage(PTE2PA(pte)))
+    return 0; //the zero page stands for a reserved page
+  if(count_cached(PTE2PA(pte)))
+    return 1;
+  s = findseg(p, va);
+  return s != 0 && (s->perm & PTE_W) == 0;
+}
+
+// Is the cold page of p at va anonymous memory that only p
+// maps, so that it can go to swap?
+static int
+swappable(struct proc *p, uint64 va, pte_t pte)
+{
+  struct vma *v;
+  uint64 pa = PTE2PA(pte);
+
+  if(!count_check(pa, 1) || count_cached(pa))
+    return 0;
+  if(va < p->sz)
+    return 1;
+  v = findvma(p, va);
+  return v != 0 && v->flags == MAP_PRIVATE;
+}
+
+// Move the hand over p's page table from clock.va on, until
+// the end of the address space or until *budget entries
+// have been looked at. Cold pages are dropped until *want
+// pages have been freed, which stops the hand. With v set,
+// anonymous ones are picked for swap as well, and count as
+// freed.
+// Returns 1 if it got to the end.
+// Caller must hold clock.lock and p->lock.
+static int
+scanproc(struct proc *p, int *budget, int *want, struct victims *v)
+{
+  pagetable_t l1, l0;
+  pte_t *pte;
+  uint64 va, end, pa;
+  int shared, drop, slot;
+
+  drop = *want > 0 && p->state == SLEEPING && !p->pinned;
+  for(va = clock.va; va < MAXVA && *budget > 0; va = end){
+    end = nextregion(va, 2);
+    pte = &p->pagetable[PX(2, va)];
+    (*budget)--;
+    if((*pte & PTE_V) == 0 || PTE_LEAF(*pte))
+      continue;
+    l1 = (pagetable_t)PTE2PA(*pte);
+    end = nextregion(va, 1);
+    pte = &l1[PX(1, va)];
+    if((*pte & PTE_V) == 0)
+      continue;
+    if(PTE_LEAF(*pte)){
+      //a megapage of sbrk() memory
+      if(*pte & PTE_A){
+        *pte &= ~PTE_A;
+        p->wsacc += SUPERPGSIZE / PGSIZE;
+        continue;
+      }
+      //cold: split it, so that its pages can go to swap
+      if(!drop || v == 0 || v->n == NVICTIM || uvmsplit(p->pagetable, va) != 0)
+        continue;
+    }
+
+    l0 = (pagetable_t)PTE2PA(*pte);
+    shared = !count_check((uint64)l0, 1);
+    for(; va < end && *budget > 0; va += PGSIZE){
+      pte = &l0[PX(0, va)];
+      (*budget)--;
+      if((*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U))
+        continue;
+      if(*pte & PTE_A){
+        //used since the hand last came by
+        if(shared)
+          __sync_fetch_and_and(pte, ~PTE_A); //a sharer may be changing it
+        else
+          *pte &= ~PTE_A;
+        p->wsacc++;
+      } else if(drop && !shared && reclaimable(p, va, *pte)){
+        pa = PTE2PA(*pte);
+        *pte = PTE_DROPPED;
+        if(count_check(pa, 1)){
+          clock.nreclaimed++;
+          if(--(*want) == 0)
+            *budget = 0;
+        }
+        kfree((void*)pa);
+      } else if(drop && !shared && v && v->n < NVICTIM && swappable(p, va, *pte) &&
+                (slot = swapalloc(PTE2PA(*pte))) >= 0){
+        //the slot holds on to the page until reclaim() wrote it out
+        *pte = SLOT2PTE(slot) | (PTE_FLAGS(*pte) & ~PTE_V) | PTE_DROPPED;
+        v->slot[v->n++] = slot;
+        clock.nreclaimed++;
+        if(--(*want) == 0)
+          *budget = 0;
+      }
+    }
+  }
+  clock.va = va;
+  return va >= MAXVA;
+}
+
+// Move the hand over at most budget page-table entries, and
+// at most nsweep times round the process table, dropping
+// cold pages until want pages have been freed, and picking
+// pages for swap if v is set.
+// Returns the number of pages freed.
+// Caller must hold clock.lock.
+static int
+sweep(int budget, int want, int nsweep, struct victims *v)
+{
+  struct proc *p;
+  int left = want, steps = nsweep * NPROC, done;
+
+  while(budget > 0 && (want == 0 || left > 0) && steps-- > 0){
+    p = &proc[clock.i];
+    acquire(&p->lock);
+    done = 1;
+    if(p->state == SLEEPING || p->state == RUNNABLE || p == myproc()){
+      if(clock.va == 0)
+        p->wsacc = 0;
+      if((done = scanproc(p, &budget, &left, v)) != 0)
+        p->wss = p->wsacc;
+    }
+    release(&p->lock);
+    if(!done)
+      break;
+    clock.va = 0;
+    clock.i = (clock.i + 1) % NPROC;
+  }
+  return want - left;
+}
+
+// Only a process that holds no spinlocks may reclaim, with
+// interrupts on: the hand takes other processes' locks,
+// may take a while to free anything, and swapping out
+// waits for the disk.
+static int
+canreclaim(void)
+{
+  struct cpu *c;
+  int ok;
+
+  push_off();
+  c = mycpu();
+  ok = c->proc != 0 && c->noff == 1 && c->intena;
+  pop_off();
+  return ok;
+}
+
+// Try to free npages pages by dropping cold file pages and
+// swapping out cold anonymous ones, sweeping the process
+// table at most twice, so that every page gets its second
+// chance. At most NVICTIM pages go to swap per call.
+// Does nothing if the caller holds a spinlock. May sleep.
+// Returns the number of pages freed.
+int
+reclaim(int npages)
+{
+  struct proc *p = myproc();
+  struct victims v;
+  int n, pinned;
+
+  if(npages <= 0 || !canreclaim())
+    return 0;
+  // the caller may be using its pages, and sleeps below
+  pinned = p->pinned;
+  p->pinned = 1;
+
+  v.n = 0;
+  acquire(&clock.lock);
+  n = sweep(NOLIMIT, npages, 2, &v);
+  release(&clock.lock);
+  for(int i = 0; i < v.n; i++)
+    swapout(v.slot[i]);
+
+  p->pinned = pinned;
+  return n;
+}
+
+// Called on timer interrupts from user space. Moves the
+// hand on once per tick, and reclaims pages in the
+// background while free memory is low.
+void
+reclaimtick(void)
+{
+  acquire(&clock.lock);
+  if(clock.aged != ticks){
+    clock.aged = ticks;
+    sweep(AGEBATCH, fmemory_counting() < LOWMEM * PGSIZE ? LOWBATCH : 0, 1, 0);
+  }
+  release(&clock.lock);
+}
+
+// Number of pages reclaim has freed since boot.
+uint64
+reclaimed(void)
+{
+  return __atomic_load_n(&clock.nreclaimed, __ATOMIC_RELAXED);
+}
@@ -290,6 +290,14 @@ intr_get()
   return (x & SSTATUS_SIE) != 0;
 }
 
+// wait for an interrupt to become pending, even if
+// device interrupts are disabled.
+static inline void
+wfi()
+{
+  asm volatile("wfi");
+}
+
 static inline uint64
 r_sp()
 {
@@ -349,13 +357,20 @@ typedef uint64 *pagetable_t; // 512 PTEs
 #define PGROUNDUP(sz)  (((sz)+PGSIZE-1) & ~(PGSIZE-1))
 #define PGROUNDDOWN(a) (((a)) & ~(PGSIZE-1))
 
+#define SUPERPGSIZE (PGSIZE << 9) // bytes per megapage (level-1 leaf)
+
+#define SUPERPGROUNDUP(sz)  (((sz)+SUPERPGSIZE-1) & ~(SUPERPGSIZE-1))
+#define SUPERPGROUNDDOWN(a) (((a)) & ~(SUPERPGSIZE-1))
+
 #define PTE_V (1L << 0) // valid
 #define PTE_R (1L << 1)
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // user can access
 #define PTE_A (1L << 6) // accessed
+#define PTE_D (1L << 7) // dirty
 #define PTE_COW (1L << 8) //used for cow
+#define PTE_DROPPED (1L << 9) // not valid: reclaim() took the page, fault it back in
 
 
 // shift a physical address to the right place for a PTE.
@@ -365,6 +380,16 @@ typedef uint64 *pagetable_t; // 512 PTEs
 
 #define PTE_FLAGS(pte) ((pte) & 0x3FF)
 
+// a PTE_DROPPED PTE of an anonymous page names the swap slot
+// the page went to, and keeps its flags; see swap.c.
+#define SLOT2PTE(slot) ((((uint64)(slot)) + 1) << 10)
+#define PTE2SLOT(pte) ((int)((pte) >> 10) - 1)
+#define PTE_SWAPPED(pte) (((pte) & (PTE_V|PTE_DROPPED)) == PTE_DROPPED && PTE2SLOT(pte) >= 0)
+
+// a valid PTE with any of R/W/X set maps memory; one
+// without points to the next level's page-table page.
+#define PTE_LEAF(pte) ((pte) & (PTE_R|PTE_W|PTE_X))
+
 // extract the three 9-bit page table indices from a virtual address.
 #define PXMASK          0x1FF // 9 bits
 #define PXSHIFT(level)  (PGSHIFT+(9*(level)))
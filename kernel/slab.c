@@ -0,0 +1,225 @@
+// Slab allocator for small kernel objects.
+//
+// A cache hands out fixed-size objects carved out of whole
+// pages ("slabs") obtained from kalloc(). Each slab starts
+// with a struct slab header followed by as many objects as
+// fit; the free objects of a slab are chained through their
+// first word. Slabs that have free objects sit on the cache's
+// partial list, and a slab whose objects are all free again
+// goes back to kalloc() (unless it is the cache's last one).
+//
+// In front of the slabs each CPU keeps a small magazine of
+// free objects, so most kmem_cache_alloc()/kmem_cache_free()
+// calls only turn interrupts off and touch per-CPU state.
+// The slab lists, and their lock, are only used to refill or
+// drain a magazine MAGSIZE/2 objects at a time.
+//
+// Objects are not initialised: callers must set every field.
+//
+// Pipes, files, inodes and sigalarm trapframes come from
+// caches. struct proc does not: proc[NPROC] stays a fixed
+// table, because code all over the kernel relies on a
+// struct proc never going away. wait() and kill() look at
+// slots that may be exiting, sleepers on a wait channel and
+// run-queue entries are bare pointers, and the reclaim
+// clock walks the table by index.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define NCACHE   16   // maximum number of caches
+#define MAGSIZE  16   // objects per per-CPU magazine
+
+struct slab {
+  struct slab *next;        // on the cache's partial list
+  struct slab *prev;
+  struct kmem_cache *cache;
+  void *free;               // chain of free objects
+  int inuse;                // objects out of the slab (incl. magazines)
+};
+
+// objects start at the first 8-byte boundary after the header
+#define SLABHDR (((sizeof(struct slab)) + 7) & ~7)
+
+// the slab an object belongs to
+#define OBJ2SLAB(obj) ((struct slab*)PGROUNDDOWN((uint64)(obj)))
+
+struct magazine {
+  int n;                    // number of objects in obj[]
+  void *obj[MAGSIZE];
+};
+
+struct kmem_cache {
+  char *name;
+  uint size;                // object size, a multiple of 8
+  int perslab;              // objects per slab
+  struct spinlock lock;     // protects the slabs
+  struct slab partial;      // list head of slabs with free objects
+  struct magazine mag[NCPU];// only touched by its CPU, interrupts off
+};
+
+struct {
+  struct spinlock lock;
+  struct kmem_cache cache[NCACHE];
+  int n;
+} caches;
+
+void
+slabinit(void)
+{
+  initlock(&caches.lock, "caches");
+}
+
+// Create a cache of objects of the given size.
+// Caches are never destroyed.
+struct kmem_cache*
+kmem_cache_create(char *name, uint size)
+{
+  struct kmem_cache *c;
+
+  if(size < sizeof(void*))
+    size = sizeof(void*);
+  size = (size + 7) & ~7;
+  if(size > PGSIZE - SLABHDR)
+    panic("kmem_cache_create: size");
+
+  acquire(&caches.lock);
+  if(caches.n >= NCACHE)
+    panic("kmem_cache_create: too many caches");
+  c = &caches.cache[caches.n++];
+  release(&caches.lock);
+
+  c->name = name;
+  c->size = size;
+  c->perslab = (PGSIZE - SLABHDR) / size;
+  initlock(&c->lock, name);
+  c->partial.next = c->partial.prev = &c->partial;
+  for(int i = 0; i < NCPU; i++)
+    c->mag[i].n = 0;
+  return c;
+}
+
+// Put s at the front of c's partial list.
+// Caller must hold c->lock.
+static void
+slab_link(struct kmem_cache *c, struct slab *s)
+{
+  s->next = c->partial.next;
+  s->prev = &c->partial;
+  c->partial.next->prev = s;
+  c->partial.next = s;
+}
+
+static void
+slab_unlink(struct slab *s)
+{
+  s->prev->next = s->next;
+  s->next->prev = s->prev;
+}
+
+// Carve a fresh page into objects.
+// Caller must hold c->lock.
+static struct slab*
+slab_new(struct kmem_cache *c)
+{
+  struct slab *s;
+  char *obj;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->cache = c;
+  s->inuse = 0;
+  s->free = 0;
+  for(int i = c->perslab - 1; i >= 0; i--){
+    obj = (char*)s + SLABHDR + i * c->size;
+    *(void**)obj = s->free;
+    s->free = obj;
+  }
+  slab_link(c, s);
+  return s;
+}
+
+// Move free objects from the slabs into magazine m
+// until it holds n of them, or memory runs out.
+// Caller must hold c->lock.
+static void
+slab_refill(struct kmem_cache *c, struct magazine *m, int n)
+{
+  struct slab *s;
+  void *obj;
+
+  while(m->n < n){
+    s = c->partial.next;
+    if(s == &c->partial && (s = slab_new(c)) == 0)
+      break;
+    obj = s->free;
+    s->free = *(void**)obj;
+    s->inuse++;
+    if(s->free == 0)
+      slab_unlink(s); // full, off the partial list
+    m->obj[m->n++] = obj;
+  }
+}
+
+// Give obj back to its slab.
+// Caller must hold c->lock.
+static void
+slab_put(struct kmem_cache *c, void *obj)
+{
+  struct slab *s = OBJ2SLAB(obj);
+
+  if(s->cache != c)
+    panic("kmem_cache_free: wrong cache");
+  if(s->free == 0)
+    slab_link(c, s); // was full, has a free object again
+  *(void**)obj = s->free;
+  s->free = obj;
+  if(--s->inuse == 0 && (s->next != &c->partial || s->prev != &c->partial)){
+    // empty, and not the only slab left
+    slab_unlink(s);
+    kfree((void*)s);
+  }
+}
+
+// Allocate an object from cache c.
+// Returns 0 if the memory cannot be allocated.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct magazine *m;
+  void *obj = 0;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == 0){
+    acquire(&c->lock);
+    slab_refill(c, m, MAGSIZE / 2);
+    release(&c->lock);
+  }
+  if(m->n > 0)
+    obj = m->obj[--m->n];
+  pop_off();
+  return obj;
+}
+
+// Free an object returned by kmem_cache_alloc(c).
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  struct magazine *m;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == MAGSIZE){
+    acquire(&c->lock);
+    while(m->n > MAGSIZE / 2)
+      slab_put(c, m->obj[--m->n]);
+    release(&c->lock);
+  }
+  m->obj[m->n++] = obj;
+  pop_off();
+}
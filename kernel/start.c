@@ -11,9 +11,10 @@ void timerinit();
 __attribute__ ((aligned (16))) char stack0[4096 * NCPU];
 
 // a scratch area per CPU for machine-mode timer interrupts.
-uint64 timer_scratch[NCPU][5];
+uint64 timer_scratch[NCPU][NSCRATCH];
 
-// assembly code in kernelvec.S for machine-mode timer interrupt.
+// assembly code in kernelvec.S for machine-mode timer and
+// software interrupts.
 extern void timervec();
 
 // entry.S jumps here in machine mode on stack0.
@@ -59,7 +60,8 @@ start()
   asm volatile("mret");
 }
 
-// arrange to receive timer interrupts.
+// arrange to receive timer interrupts, and interrupts
+// from other harts (see ipi() in trap.c).
 // they will arrive in machine mode at
 // at timervec in kernelvec.S,
 // which turns them into software interrupts for
@@ -71,16 +73,20 @@ timerinit()
   int id = r_mhartid();
 
   // ask the CLINT for a timer interrupt.
-  int interval = 1000000; // cycles; about 1/10th second in qemu.
+  int interval = CLOCKINTERVAL;
   *(uint64*)CLINT_MTIMECMP(id) = *(uint64*)CLINT_MTIME + interval;
 
   // prepare information in scratch[] for timervec.
   // scratch[0..2] : space for timervec to save registers.
   // scratch[3] : address of CLINT MTIMECMP register.
   // scratch[4] : desired interval (in cycles) between timer interrupts.
+  // scratch[5] : address of CLINT MSIP register.
+  // scratch[6] : set by timervec on a timer interrupt, for devintr().
   uint64 *scratch = &timer_scratch[id][0];
   scratch[3] = CLINT_MTIMECMP(id);
   scratch[4] = interval;
+  scratch[5] = CLINT_MSIP(id);
+  scratch[6] = 0;
   w_mscratch((uint64)scratch);
 
   // set the machine-mode trap handler.
@@ -89,6 +95,6 @@ timerinit()
   // enable machine-mode interrupts.
   w_mstatus(r_mstatus() | MSTATUS_MIE);
 
-  // enable machine-mode timer interrupts.
-  w_mie(r_mie() | MIE_MTIE);
+  // enable machine-mode timer and software interrupts.
+  w_mie(r_mie() | MIE_MTIE | MIE_MSIE);
 }
@@ -0,0 +1,144 @@
+// Swap space for anonymous memory.
+//
+// The swap area is a range of blocks past the end of the file
+// system, laid out by mkfs, and divided into page-sized slots.
+// reclaim() moves cold anonymous pages out: it replaces the
+// page's PTE by one with PTE_DROPPED set that names the slot
+// and keeps the page's flags, then writes the page out with
+// swapout(). The next touch reads it back, see lazyfault().
+//
+// Like a page, a slot has a reference for each PTE that names
+// it, since fork() shares page-table pages, and is free again
+// once the last one is gone. While a page is being written out
+// the slot holds on to it, and swapin() copies it from memory
+// rather than reading a slot that is not written yet.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "defs.h"
+#include "fs.h"
+
+#define SLOTBLOCKS (PGSIZE / BSIZE)
+#define NSLOT      (SWAPSIZE / SLOTBLOCKS)
+
+struct {
+  struct spinlock lock;
+  uint start;               // first block of the swap area
+  int nslot;                // 0 until swapinit()
+  int next;                 // where to look for a free slot
+  int nused;                // slots in use
+  ushort ref[NSLOT];        // references to each slot
+  uint64 pa[NSLOT];         // page being written to the slot, or 0
+} swap;
+
+// Called by fsinit() once the super block is read.
+void
+swapinit(int dev, struct superblock *sb)
+{
+  initlock(&swap.lock, "swap");
+  swap.start = sb->swapstart;
+  swap.nslot = sb->nswap / SLOTBLOCKS;
+  if(swap.nslot > NSLOT)
+    swap.nslot = NSLOT;
+}
+
+// Allocate a slot for the page at pa, which the caller is
+// about to write out with swapout(). The slot starts with a
+// reference for the caller's PTE, and keeps the page until
+// swapout() is done.
+// Returns the slot, or -1 if swap is full. Doesn't sleep.
+int
+swapalloc(uint64 pa)
+{
+  int i, slot;
+
+  if(swap.nslot == 0)
+    return -1;
+  acquire(&swap.lock);
+  for(i = 0; i < swap.nslot; i++){
+    slot = (swap.next + i) % swap.nslot;
+    if(swap.ref[slot] == 0)
+      break;
+  }
+  if(i == swap.nslot){
+    release(&swap.lock);
+    return -1;
+  }
+  swap.next = slot + 1;
+  swap.ref[slot] = 2; // the PTE, and swapout()
+  swap.pa[slot] = pa;
+  swap.nused++;
+  release(&swap.lock);
+  return slot;
+}
+
+// Write the page swapalloc() gave slot out to it, and
+// drop the page.
+void
+swapout(int slot)
+{
+  uint64 pa = swap.pa[slot];
+
+  virtio_disk_rwpage(swap.start + slot * SLOTBLOCKS, (void*)pa, 1);
+  acquire(&swap.lock);
+  swap.pa[slot] = 0;
+  release(&swap.lock);
+  swapfree(slot);
+  kfree((void*)pa);
+}
+
+// Return a new page with the contents of slot, or 0 if out
+// of memory. The caller's reference to slot is kept.
+uint64
+swapin(int slot)
+{
+  uint64 pa, old;
+
+  if((pa = (uint64)kalloc()) == 0)
+    return 0;
+  acquire(&swap.lock);
+  if((old = swap.pa[slot]) != 0)
+    count_incre(old);
+  release(&swap.lock);
+  if(old){
+    // still being written out
+    memmove((void*)pa, (void*)old, PGSIZE);
+    kfree((void*)old);
+  } else {
+    virtio_disk_rwpage(swap.start + slot * SLOTBLOCKS, (void*)pa, 0);
+  }
+  return pa;
+}
+
+// Take another reference to slot, for a copy of its PTE.
+void
+swapdup(int slot)
+{
+  acquire(&swap.lock);
+  if(swap.ref[slot] == 0)
+    panic("swapdup");
+  swap.ref[slot]++;
+  release(&swap.lock);
+}
+
+// Drop a reference to slot.
+void
+swapfree(int slot)
+{
+  acquire(&swap.lock);
+  if(swap.ref[slot] == 0)
+    panic("swapfree");
+  if(--swap.ref[slot] == 0)
+    swap.nused--;
+  release(&swap.lock);
+}
+
+// Number of slots in use, for sysinfo().
+uint64
+swapused(void)
+{
+  return __atomic_load_n(&swap.nused, __ATOMIC_RELAXED);
+}
@@ -105,6 +105,10 @@ extern uint64 sys_trace(void);
 extern uint64 sys_sysinfo(void);
 extern uint64 sys_sigalarm(void);
 extern uint64 sys_sigreturn(void);
+extern uint64 sys_spawn(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_setpriority(void);
 //Newly added
 
 #ifdef LAB_NET
@@ -142,6 +146,13 @@ char * System_calls[] =
     "sysinfo",
     "sigalarm",
     "sigreturn",
+    "symlink",
+    "mmap",
+    "munmap",
+    "connect",
+    "pgaccess",
+    "spawn",
+    "setpriority",
 };
 
 // An array mapping syscall numbers from syscall.h
@@ -172,6 +183,10 @@ static uint64 (*syscalls[])(void) = {
 [SYS_sysinfo] sys_sysinfo,
 [SYS_sigalarm] sys_sigalarm,
 [SYS_sigreturn] sys_sigreturn,
+[SYS_spawn]   sys_spawn,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_setpriority] sys_setpriority,
 //Newly added
 
 #ifdef LAB_NET
@@ -196,6 +211,7 @@ syscall(void)
     // Use num to lookup the system call function for num, call it,
     // and store its return value in p->trapframe->a0
     p->trapframe->a0 = syscalls[num]();
+    p->pinned = 0; //see loadrange()
 
     if((p -> mask_num & (1 << num)) != 0)
     {
@@ -30,4 +30,6 @@
 #define SYS_mmap      27
 #define SYS_munmap    28
 #define SYS_connect   29
-#define SYS_pgaccess  30
\ No newline at end of file
+#define SYS_pgaccess  30
+#define SYS_spawn     31
+#define SYS_setpriority 32
\ No newline at end of file
@@ -76,6 +76,8 @@ sys_read(void)
   argint(2, &n);
   if(argfd(0, 0, &f) < 0)
     return -1;
+  if(n > 0)
+    loadrange(myproc(), p, n); //copied to with locks held
   return fileread(f, p, n);
 }
 
@@ -90,6 +92,8 @@ sys_write(void)
   argint(2, &n);
   if(argfd(0, 0, &f) < 0)
     return -1;
+  if(n > 0)
+    loadrange(myproc(), p, n); //copied from with locks held
 
   return filewrite(f, p, n);
 }
@@ -341,6 +345,13 @@ sys_open(void)
     return -1;
   }
 
+  // a running program's text can't be truncated (ETXTBSY)
+  if((omode & O_TRUNC) && ip->type == T_FILE && atomic_read4(&ip->nexec) != 0){
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
+
   if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
     if(f)
       fileclose(f);
@@ -431,24 +442,22 @@ sys_chdir(void)
   return 0;
 }
 
-uint64
-sys_exec(void)
+// Fetch the user argument vector at uargv into argv,
+// one kalloc()ed page per string. Returns 0, or -1 with
+// whatever was fetched in argv, which freeargv() frees.
+static int
+fetchargv(uint64 uargv, char **argv)
 {
-  char path[MAXPATH], *argv[MAXARG];
   int i;
-  uint64 uargv, uarg;
+  uint64 uarg;
 
-  argaddr(1, &uargv);
-  if(argstr(0, path, MAXPATH) < 0) {
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, MAXARG*sizeof(char*));
   for(i=0;; i++){
-    if(i >= NELEM(argv)){
-      goto bad;
+    if(i >= MAXARG){
+      return -1;
     }
     if(fetchaddr(uargv+sizeof(uint64)*i, (uint64*)&uarg) < 0){
-      goto bad;
+      return -1;
     }
     if(uarg == 0){
       argv[i] = 0;
@@ -456,22 +465,95 @@ sys_exec(void)
     }
     argv[i] = kalloc();
     if(argv[i] == 0)
-      goto bad;
+      return -1;
     if(fetchstr(uarg, argv[i], PGSIZE) < 0)
-      goto bad;
+      return -1;
   }
+  return 0;
+}
 
-  int ret = exec(path, argv);
-
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
+static void
+freeargv(char **argv)
+{
+  for(int i = 0; i < MAXARG && argv[i] != 0; i++)
     kfree(argv[i]);
+}
 
+uint64
+sys_exec(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  uint64 uargv;
+  int ret = -1;
+
+  argaddr(1, &uargv);
+  if(argstr(0, path, MAXPATH) < 0) {
+    return -1;
+  }
+  if(fetchargv(uargv, argv) == 0)
+    ret = exec(path, argv);
+  freeargv(argv);
   return ret;
+}
 
- bad:
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
-  return -1;
+// spawn(path, argv, fds): start path in a new process.
+// fds is 0, for the child to get all of the caller's open
+// files, or points to three file descriptors (or -1) to
+// become the child's 0, 1 and 2, and its only open files.
+uint64
+sys_spawn(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  struct file *files[3];
+  uint64 uargv, ufds;
+  int fds[3], ret = -1;
+
+  argaddr(1, &uargv);
+  argaddr(2, &ufds);
+  if(argstr(0, path, MAXPATH) < 0)
+    return -1;
+  if(ufds){
+    if(copyin(myproc()->pagetable, (char*)fds, ufds, sizeof(fds)) < 0)
+      return -1;
+    for(int i = 0; i < 3; i++){
+      files[i] = 0;
+      if(fds[i] == -1)
+        continue;
+      if(fds[i] < 0 || fds[i] >= NOFILE || (files[i] = myproc()->ofile[fds[i]]) == 0)
+        return -1;
+    }
+  }
+  if(fetchargv(uargv, argv) == 0)
+    ret = spawn(path, argv, ufds ? files : 0);
+  freeargv(argv);
+  return ret;
+}
+
+uint64
+sys_mmap(void)
+{
+  uint64 len, off;
+  int prot, flags;
+  struct file *f;
+
+  // argument 0, the address, is only a hint, and ignored
+  argaddr(1, &len);
+  argint(2, &prot);
+  argint(3, &flags);
+  argaddr(5, &off);
+  if(argfd(4, 0, &f) < 0)
+    return -1;
+  return mmap(len, prot, flags, f, off);
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr, len;
+
+  argaddr(0, &addr);
+  argaddr(1, &len);
+  return munmap(addr, len);
 }
 
 uint64
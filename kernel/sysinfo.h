@@ -1,4 +1,16 @@
+// Allocator counters of one CPU. Needs param.h for NCPU.
+struct kmemstat {
+  uint64 nfree;     // pages on the CPU's free page cache
+  uint64 nalloc;    // pages handed out by kalloc() on the CPU
+  uint64 nfreed;    // pages freed by kfree() on the CPU
+  uint64 nsteal;    // pages the CPU stole from other CPUs' caches
+};
+
 struct sysinfo {
   uint64 freemem;   // amount of free memory (bytes)
   uint64 nproc;     // number of process
+  uint64 nreclaimed;// pages freed by page reclaim since boot
+  uint64 wss;       // working set of the caller, in pages
+  uint64 nswapped;  // pages out on swap
+  struct kmemstat kmem[NCPU];
 };
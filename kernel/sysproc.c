@@ -9,6 +9,7 @@
 
 uint64 fmemory_counting(void);
 uint64 fproc_counting(void);
+void fmemory_stats(struct kmemstat *st);
 //Add the prototype
 //for the linker to search for the function
 
@@ -58,26 +59,15 @@ uint64
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
 
   argint(0, &n);
-  acquire(&tickslock);
-  ticks0 = ticks;
 
 #ifdef LAB_TRAPS
   backtrace();
   //Add the backtrace function here to backtrace the call of functions
 #endif
 
-  while(ticks - ticks0 < n){
-    if(killed(myproc())){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  return sleepticks(n);
 }
 
 
@@ -125,6 +115,17 @@ sys_kill(void)
   return kill(pid);
 }
 
+// set the nice value of a process, -20 (favoured) to 19.
+uint64
+sys_setpriority(void)
+{
+  int pid, nice;
+
+  argint(0, &pid);
+  argint(1, &nice);
+  return setpriority(pid, nice);
+}
+
 // return how many clock tick interrupts have occurred
 // since start.
 uint64
@@ -177,6 +178,14 @@ sys_sysinfo(void)
   info.nproc = fproc_counting();
   //Get the number of processes
 
+  fmemory_stats(info.kmem);
+  //Get the per-CPU allocator counters
+
+  info.nreclaimed = reclaimed();
+  info.wss = current_proc -> wss;
+  info.nswapped = swapused();
+  //Get the page reclaim counters, see reclaim.c
+
   // printf("%d\n", info.freemem);
   // printf("%d\n", info.nproc);
 
@@ -209,11 +218,14 @@ uint64
 sys_sigreturn(void)
 {
   struct proc * my_proc = myproc();
+  my_proc -> a0 = 0;
   if(my_proc -> is_handler)
   {
     my_proc -> is_handler = 0;
     *(my_proc -> trapframe) = *(my_proc -> backup_trapframe);
     my_proc -> ticks_count = 0;
+    //syscall() hands this back, so a0 survives the return
+    my_proc -> a0 = my_proc -> trapframe -> a0;
   }
   return 0;
 }
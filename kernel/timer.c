@@ -0,0 +1,147 @@
+// Kernel timers.
+//
+// A timer calls its function once the tick count reaches its
+// deadline, from the clock interrupt. Pending timers hang on a
+// wheel of NWHEEL slots, by deadline modulo NWHEEL, so each
+// tick only looks at the timers of one slot, and adding or
+// removing a timer takes constant time. A timer more than
+// NWHEEL ticks away is passed over until its round comes.
+//
+// sleep() system calls use the timer in struct proc. The
+// functions run in the clock interrupt, with wheel.lock held,
+// and must not sleep or take it again.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define NWHEEL 64
+
+struct {
+  struct spinlock lock;
+  uint now;                 // the last tick the wheel turned to
+  struct timer *slot[NWHEEL];
+} wheel;
+
+void
+timerinit(void)
+{
+  initlock(&wheel.lock, "timers");
+}
+
+// Hang t on the wheel to fire n ticks from now.
+// Caller must hold wheel.lock.
+static void
+arm(struct timer *t, uint n)
+{
+  struct timer **slot;
+
+  if(n == 0)
+    n = 1; // the current tick has already been run
+  t->expires = wheel.now + n;
+  slot = &wheel.slot[t->expires % NWHEEL];
+  t->next = *slot;
+  t->pprev = slot;
+  if(*slot)
+    (*slot)->pprev = &t->next;
+  *slot = t;
+  t->pending = 1;
+}
+
+// Take t off the wheel.
+// Caller must hold wheel.lock.
+static void
+disarm(struct timer *t)
+{
+  *t->pprev = t->next;
+  if(t->next)
+    t->next->pprev = t->pprev;
+  t->pending = 0;
+}
+
+// Start t, so that t->fn(t) is called n ticks from now, and
+// then every t->period ticks if that is not 0. A pending t
+// is restarted.
+void
+timer_add(struct timer *t, uint n)
+{
+  acquire(&wheel.lock);
+  if(t->pending)
+    disarm(t);
+  arm(t, n);
+  release(&wheel.lock);
+}
+
+// Stop t. Once this returns, t->fn is not running and will
+// not be called. Returns 1 if t was pending.
+int
+timer_del(struct timer *t)
+{
+  int pending;
+
+  acquire(&wheel.lock);
+  if((pending = t->pending) != 0)
+    disarm(t);
+  release(&wheel.lock);
+  return pending;
+}
+
+// Called by clockintr() after it advanced ticks to now.
+// Runs the timers that are due.
+void
+timertick(uint now)
+{
+  struct timer *t, *next;
+
+  acquire(&wheel.lock);
+  while(wheel.now != now){
+    wheel.now++;
+    for(t = wheel.slot[wheel.now % NWHEEL]; t; t = next){
+      next = t->next;
+      if(t->expires != wheel.now)
+        continue; // a later round
+      disarm(t);
+      if(t->period)
+        arm(t, t->period);
+      t->fn(t);
+    }
+  }
+  release(&wheel.lock);
+}
+
+static void
+timerwake(struct timer *t)
+{
+  wakeup(t);
+}
+
+// Put the current process to sleep for n ticks.
+// Returns 0, or -1 if it was killed meanwhile.
+int
+sleepticks(uint n)
+{
+  struct proc *p = myproc();
+  struct timer *t = &p->timer;
+  int r = 0;
+
+  if(n == 0)
+    return 0;
+  t->fn = timerwake;
+  t->period = 0;
+  acquire(&wheel.lock);
+  arm(t, n);
+  while(t->pending){
+    if(killed(p)){
+      disarm(t);
+      r = -1;
+      break;
+    }
+    sleep(t, &wheel.lock);
+  }
+  release(&wheel.lock);
+  return r;
+}
@@ -9,6 +9,8 @@
 struct spinlock tickslock;
 uint ticks;
 
+extern uint64 timer_scratch[NCPU][NSCRATCH]; // start.c
+
 extern char trampoline[], uservec[], userret[];
 
 // in kernelvec.S, calls kerneltrap().
@@ -67,11 +69,29 @@ usertrap(void)
     syscall();
   } 
   
-  else if(r_scause() == 15) //cow-fork metting write
+  else if(r_scause() == 12 || r_scause() == 13) //fetch or load from an untouched page
   {
+    uint64 va = r_stval();
+
+    // reading the page from the executable may sleep,
+    // and stval is no longer needed.
+    intr_on();
+
+    if(lazyfault(p -> pagetable, va, 0) == 0)
+    {
+      setkilled(p);
+    }
+  }
+
+  else if(r_scause() == 15) //cow-fork metting write, or untouched page
+  {
+    uint64 va = r_stval();
+
+    intr_on();
+
     // if(is_cow(p -> pagetable, r_stval()))
     // {
-      if(cow_fault_handler(p -> pagetable, r_stval()) == 0)
+      if(cow_fault_handler(p -> pagetable, va) == 0)
       {
         setkilled(p);
       }
@@ -93,8 +113,18 @@ usertrap(void)
     exit(-1);
 
   // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2)
+  if(which_dev == 2){
+    // the sigalarm() interval counts the ticks p has run for;
+    // call the handler once it is up, but not from inside
+    // the handler itself.
+    if(p->interval > 0 && ++p->ticks_count >= p->interval && !p->is_handler){
+      *p->backup_trapframe = *p->trapframe;
+      p->trapframe->epc = (uint64)p->handler;
+      p->is_handler = 1;
+    }
+    reclaimtick();
     yield();
+  }
 
   usertrapret();
 }
@@ -179,10 +209,42 @@ kerneltrap()
 void
 clockintr()
 {
+  uint now;
+
   acquire(&tickslock);
-  ticks++;
-  wakeup(&ticks);
+  now = ++ticks;
   release(&tickslock);
+  // sleepers are woken by their timers
+  timertick(now);
+}
+
+// Stop the clock interrupts of this hart, while it is idle.
+// Hart 0 keeps its clock, which drives ticks.
+// Must be called with interrupts disabled.
+void
+clockoff(void)
+{
+  int id = cpuid();
+
+  if(id != 0)
+    *(uint64*)CLINT_MTIMECMP(id) = ~0UL;
+}
+
+// Restart the clock interrupts of this hart.
+void
+clockon(void)
+{
+  int id = cpuid();
+
+  if(id != 0)
+    *(uint64*)CLINT_MTIMECMP(id) = *(uint64*)CLINT_MTIME + CLOCKINTERVAL;
+}
+
+// Send an interrupt to hart, to wake it from wfi.
+void
+ipi(int hart)
+{
+  *(uint32*)CLINT_MSIP(hart) = 1;
 }
 
 // check if it's an external interrupt or software interrupt,
@@ -219,15 +281,20 @@ devintr()
     return 1;
   } else if(scause == 0x8000000000000001L){
     // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
+    // or from another hart's ipi(), forwarded by timervec in
+    // kernelvec.S.
+
+    // acknowledge the software interrupt by clearing
+    // the SSIP bit in sip, before looking at what it was,
+    // so that a tick that comes meanwhile is not lost.
+    w_sip(r_sip() & ~2);
+
+    if(__atomic_exchange_n(&timer_scratch[cpuid()][6], 0, __ATOMIC_RELAXED) == 0)
+      return 1; // just woken up
 
     if(cpuid() == 0){
       clockintr();
     }
-    
-    // acknowledge the software interrupt by clearing
-    // the SSIP bit in sip.
-    w_sip(r_sip() & ~2);
 
     return 2;
   } else {
@@ -46,7 +46,7 @@ static struct disk {
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    int *busy;    // cleared, and woken up, when the request is done
     char status;
   } info[NUM];
 
@@ -234,17 +234,17 @@ checkbuf(struct buf *b)
 }
 #endif
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// Transfer len bytes between the memory at pa and the disk,
+// starting at block blockno, and wait until it is done.
+// *busy is the request's flag, which virtio_disk_intr()
+// clears.
+static void
+virtio_disk_xfer(uint blockno, uint64 pa, uint len, int write, int *busy)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
+  uint64 sector = blockno * (BSIZE / 512);
 
   acquire(&disk.vdisk_lock);
 
-#ifdef LAB_LOCK
-  checkbuf(b);
-#endif
-
   // the spec's Section 5.2 says that legacy block operations use
   // three descriptors: one for type/reserved/sector, one for the
   // data, one for a 1-byte status result.
@@ -275,12 +275,12 @@ virtio_disk_rw(struct buf *b, int write)
   disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
   disk.desc[idx[0]].next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
+  disk.desc[idx[1]].addr = pa;
+  disk.desc[idx[1]].len = len;
   if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
+    disk.desc[idx[1]].flags = 0; // device reads the memory
   else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
+    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes the memory
   disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
   disk.desc[idx[1]].next = idx[2];
 
@@ -290,9 +290,9 @@ virtio_disk_rw(struct buf *b, int write)
   disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
   disk.desc[idx[2]].next = 0;
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  // record the request's flag for virtio_disk_intr().
+  *busy = 1;
+  disk.info[idx[0]].busy = busy;
 
   // tell the device the first index in our chain of descriptors.
   disk.avail->ring[disk.avail->idx % NUM] = idx[0];
@@ -307,16 +307,38 @@ virtio_disk_rw(struct buf *b, int write)
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
 
   // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
+  while(*busy == 1) {
+    sleep(busy, &disk.vdisk_lock);
   }
 
-  disk.info[idx[0]].b = 0;
+  disk.info[idx[0]].busy = 0;
   free_chain(idx[0]);
 
   release(&disk.vdisk_lock);
 }
 
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+#ifdef LAB_LOCK
+  acquire(&disk.vdisk_lock);
+  checkbuf(b);
+  release(&disk.vdisk_lock);
+#endif
+  virtio_disk_xfer(b->blockno, (uint64)b->data, BSIZE, write, &b->disk);
+}
+
+// Read or write the page at pa from or to the PGSIZE/BSIZE
+// blocks starting at blockno, bypassing the buffer cache.
+// Used for swap.
+void
+virtio_disk_rwpage(uint blockno, void *pa, int write)
+{
+  int busy;
+
+  virtio_disk_xfer(blockno, (uint64)pa, PGSIZE, write, &busy);
+}
+
 void
 virtio_disk_intr()
 {
@@ -342,9 +364,9 @@ virtio_disk_intr()
     if(disk.info[id].status != 0)
       panic("virtio_disk_intr status");
 
-    struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    int *busy = disk.info[id].busy;
+    *busy = 0;   // disk is done with the request
+    wakeup(busy);
 
     disk.used_idx += 1;
   }
@@ -5,6 +5,8 @@
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
+#include "spinlock.h"
+#include "proc.h"
 
 /*
  * the kernel's page table.
@@ -15,6 +17,11 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+static pte_t *walklevel(pagetable_t pagetable, uint64 va, int alloc, int target);
+
+// kalloc_order() of a megapage
+#define SUPERPGORDER 9
+
 //helper function for vmprint
 void printwalk(pagetable_t pagetable, int level)
 {
@@ -62,8 +69,7 @@ kvmmake(void)
 {
   pagetable_t kpgtbl;
 
-  kpgtbl = (pagetable_t) kalloc();
-  memset(kpgtbl, 0, PGSIZE);
+  kpgtbl = (pagetable_t) kalloc_zeroed();
 
   // uart registers
   kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
@@ -74,6 +80,10 @@ kvmmake(void)
   // PLIC
   kvmmap(kpgtbl, PLIC, PLIC, 0x400000, PTE_R | PTE_W);
 
+  // CLINT, for idle harts to stop their clocks and wake
+  // each other, see trap.c
+  kvmmap(kpgtbl, CLINT, CLINT, 0x10000, PTE_R | PTE_W);
+
   // map kernel text executable and read-only.
   kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
 
@@ -90,11 +100,18 @@ kvmmake(void)
   return kpgtbl;
 }
 
+// The page of zeroes that stands in for anonymous pages
+// that have been read but never written, see uvmzero().
+static uint64 zeropage;
+
 // Initialize the one kernel_pagetable
 void
 kvminit(void)
 {
   kernel_pagetable = kvmmake();
+  //never freed: this reference is kept for good
+  if((zeropage = (uint64)kalloc_zeroed()) == 0)
+    panic("kvminit: zero page");
 }
 
 // Switch h/w page table register to the kernel's page table,
@@ -123,24 +140,106 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+//
+// A leaf may also sit at level 1 (a 2 MiB megapage) or level 2
+// (a 1 GiB gigapage). walk() then returns that leaf instead of
+// a level-0 PTE, and never allocates below it.
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
+{
+  return walklevel(pagetable, va, alloc, 0);
+}
+
+// Drop a reference to the level-0 page-table page l0 of a
+// user page table. The last reference frees the pages it
+// maps, and the swap slots, and the page-table page itself.
+static void
+droptable(pagetable_t l0)
+{
+  if(count_decre((uint64)l0) > 0)
+    return; //another page table still shares it
+  for(int i = 0; i < 512; i++){
+    if(l0[i] & PTE_V)
+      kfree((void*)PTE2PA(l0[i]));
+    else if(PTE_SWAPPED(l0[i]))
+      swapfree(PTE2SLOT(l0[i]));
+  }
+  count_init((uint64)l0, 1);
+  kfree((void*)l0);
+}
+
+// Make the level-0 page-table page that the level-1 PTE
+// *pte points to private, copying it if fork() left it
+// shared with other page tables. The pages it maps are
+// then shared page by page, copy-on-write as usual.
+// Returns 0 on success, -1 if out of memory.
+static int
+unsharetable(pte_t *pte)
+{
+  pagetable_t old = (pagetable_t)PTE2PA(*pte), new;
+
+  if(count_check((uint64)old, 1))
+    return 0;
+  if((new = (pagetable_t)kalloc()) == 0)
+    return -1;
+  for(int i = 0; i < 512; i++){
+    new[i] = old[i];
+    if(old[i] & PTE_V)
+      count_incre(PTE2PA(old[i]));
+    else if(PTE_SWAPPED(old[i]))
+      swapdup(PTE2SLOT(old[i]));
+  }
+  *pte = PA2PTE(new) | PTE_V;
+  droptable(old);
+  return 0;
+}
+
+// Like walk(), but return the PTE at the given level
+// (0 for a 4 KiB leaf, 1 for a 2 MiB one), or the leaf
+// found above that level.
+// With alloc set the caller means to change the PTE, so a
+// shared level-0 page-table page is made private first.
+static pte_t *
+walklevel(pagetable_t pagetable, uint64 va, int alloc, int target)
 {
   if(va >= MAXVA)
     panic("walk");
 
-  for(int level = 2; level > 0; level--) {
+  for(int level = 2; level > target; level--) {
     pte_t *pte = &pagetable[PX(level, va)];
     if(*pte & PTE_V) {
+      if(PTE_LEAF(*pte))
+        return pte;
+      if(level == 1 && alloc && unsharetable(pte) < 0)
+        return 0;
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
-  return &pagetable[PX(0, va)];
+  return &pagetable[PX(target, va)];
+}
+
+// Return the valid leaf PTE that maps va, or 0 if there
+// is none. Sets *level to the level of the leaf.
+pte_t *
+walkleaf(pagetable_t pagetable, uint64 va, int *level)
+{
+  pte_t *pte;
+
+  if(va >= MAXVA)
+    return 0;
+
+  for(*level = 2; ; (*level)--) {
+    pte = &pagetable[PX(*level, va)];
+    if((*pte & PTE_V) == 0)
+      return 0;
+    if(PTE_LEAF(*pte) || *level == 0)
+      return pte;
+    pagetable = (pagetable_t)PTE2PA(*pte);
+  }
 }
 
 // Look up a virtual address, return the physical address,
@@ -151,29 +250,48 @@ walkaddr(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
   uint64 pa;
+  int level;
 
   if(va >= MAXVA)
     return 0;
 
-  pte = walk(pagetable, va, 0);
+  pte = walkleaf(pagetable, va, &level);
   if(pte == 0)
-    return 0;
-  if((*pte & PTE_V) == 0)
-    return 0;
+    return lazyfault(pagetable, va, 0);
   if((*pte & PTE_U) == 0)
     return 0;
-  pa = PTE2PA(*pte);
+  //the 4 KiB page of va within a bigger leaf
+  pa = PTE2PA(*pte) + (PGROUNDDOWN(va) & ((1L << PXSHIFT(level)) - 1));
   return pa;
 }
 
 // add a mapping to the kernel page table.
 // only used when booting.
 // does not flush TLB or enable paging.
+// uses 2 MiB megapages where va and pa are both aligned,
+// 4 KiB pages for the rest.
 void
 kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 {
-  if(mappages(kpgtbl, va, sz, pa, perm) != 0)
-    panic("kvmmap");
+  uint64 n;
+
+  while(sz > 0){
+    if(va % SUPERPGSIZE == 0 && pa % SUPERPGSIZE == 0 && sz >= SUPERPGSIZE){
+      n = SUPERPGROUNDDOWN(sz);
+      if(mapleaves(kpgtbl, va, n, pa, perm, 1) != 0)
+        panic("kvmmap");
+    } else {
+      //4 KiB pages up to the next 2 MiB boundary of va
+      n = SUPERPGROUNDUP(va + 1) - va;
+      if(n > sz)
+        n = sz;
+      if(mappages(kpgtbl, va, n, pa, perm) != 0)
+        panic("kvmmap");
+    }
+    va += n;
+    pa += n;
+    sz -= n;
+  }
 }
 
 // Create PTEs for virtual addresses starting at va that refer to
@@ -183,60 +301,252 @@ kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 // allocate a needed page-table page.
 int
 mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
+{
+  return mapleaves(pagetable, va, size, pa, perm, 0);
+}
+
+// Like mappages(), but with leaves at the given level:
+// 0 for 4 KiB pages, 1 for 2 MiB megapages. va, pa and
+// size MUST be aligned to the leaf size.
+int
+mapleaves(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm, int level)
 {
   uint64 a, last;
+  uint64 leafsz = 1L << PXSHIFT(level);
   pte_t *pte;
 
-  if((va % PGSIZE) != 0)
+  if((va % leafsz) != 0)
     panic("mappages: va not aligned");
 
-  if((size % PGSIZE) != 0)
+  if((size % leafsz) != 0)
     panic("mappages: size not aligned");
 
+  if((pa % leafsz) != 0)
+    panic("mappages: pa not aligned");
+
   if(size == 0)
     panic("mappages: size");
   
   a = va;
-  last = va + size - PGSIZE;
+  last = va + size - leafsz;
   for(;;){
-    if((pte = walk(pagetable, a, 1)) == 0)
+    if((pte = walklevel(pagetable, a, 1, level)) == 0)
       return -1;
     if(*pte & PTE_V)
       panic("mappages: remap");
     *pte = PA2PTE(pa) | perm | PTE_V;
     if(a == last)
       break;
-    a += PGSIZE;
-    pa += PGSIZE;
+    a += leafsz;
+    pa += leafsz;
   }
   return 0;
 }
 
+// If the level-0 page-table page for va is shared with
+// other page tables, and maps nothing outside [va, end),
+// detach it from pagetable and drop the reference to it.
+// Returns the number of bytes from va to the end of its
+// 2 MiB stretch or to end, or 0 if the page-table page is
+// not such a shared one. *holes gets the number of pages
+// in that stretch that were not mapped.
+static uint64
+uvmunmapshared(pagetable_t pagetable, uint64 va, uint64 end, uint64 *holes)
+{
+  pte_t *pte;
+  pagetable_t l0;
+  uint64 base, a, stop;
+
+  pte = walklevel(pagetable, va, 0, 1);
+  if(pte == 0 || (*pte & PTE_V) == 0 || PTE_LEAF(*pte))
+    return 0;
+  l0 = (pagetable_t)PTE2PA(*pte);
+  if(count_check((uint64)l0, 1))
+    return 0;
+
+  base = SUPERPGROUNDDOWN(va);
+  stop = base + SUPERPGSIZE < end ? base + SUPERPGSIZE : end;
+  *holes = 0;
+  for(int i = 0; i < 512; i++){
+    a = base + i * PGSIZE;
+    if(l0[i] != 0){
+      //mapped, or dropped by reclaim()
+      if(a < va || a >= stop)
+        return 0;
+      if((l0[i] & PTE_V) && iszeropage(PTE2PA(l0[i])))
+        (*holes)++;
+    } else if(a >= va && a < stop){
+      (*holes)++;
+    }
+  }
+  *pte = 0;
+  droptable(l0);
+  return stop - va;
+}
+
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. Pages that were never touched since sbrk()
+// have no mapping and are skipped, and count as not mapped
+// like those that only map the zero page. So are pages
+// reclaim() dropped, but their marked PTEs are cleared,
+// and their swap slots freed.
 // Optionally free the physical memory.
-void
+// Megapages must be covered completely; see uvmsplit().
+// So must page-table pages shared since fork(), unless
+// uvmunshare() made them private first.
+// Returns the number of pages that were not mapped.
+uint64
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
-  uint64 a;
+  uint64 a, sz, h, holes = 0;
   pte_t *pte;
+  int level;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
-  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
-    if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
-    if(PTE_FLAGS(*pte) == PTE_V)
-      panic("uvmunmap: not a leaf");
+  for(a = va; a < va + npages*PGSIZE; a += sz){
+    sz = PGSIZE;
+    if(do_free && (sz = uvmunmapshared(pagetable, a, va + npages*PGSIZE, &h)) != 0){
+      holes += h;
+      continue;
+    }
+    sz = PGSIZE;
+    if((pte = walkleaf(pagetable, a, &level)) == 0){
+      if((pte = walklevel(pagetable, a, 0, 0)) != 0 && (*pte & PTE_DROPPED)){
+        //it was mapped once, so it is not reserved
+        if(!count_check(PGROUNDDOWN((uint64)pte), 1))
+          panic("uvmunmap: shared page table");
+        if(do_free && PTE_SWAPPED(*pte))
+          swapfree(PTE2SLOT(*pte));
+        *pte = 0;
+      } else {
+        holes++;
+      }
+      continue;
+    }
+    if(level > 0){
+      sz = 1L << PXSHIFT(level);
+      if(level > 1 || (a % sz) != 0 || a + sz > va + npages*PGSIZE)
+        panic("uvmunmap: partial megapage");
+    }
+    if(level == 0 && !count_check(PGROUNDDOWN((uint64)pte), 1))
+      panic("uvmunmap: shared page table");
+    if(level == 0 && iszeropage(PTE2PA(*pte)))
+      holes++;
     if(do_free){
       uint64 pa = PTE2PA(*pte);
-      kfree((void*)pa);
+      if(level == 0)
+        kfree((void*)pa);
+      else
+        kfree_order((void*)pa, SUPERPGORDER);
     }
     *pte = 0;
   }
+  return holes;
+}
+
+// Replace the megapage leaf that maps va, if any, by a
+// page-table page of 4 KiB leaves with the same flags.
+// Each of the pages gets its own refcount, so they can be
+// shared and freed one at a time afterwards.
+// Returns 0 on success, -1 if out of memory.
+int
+uvmsplit(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  pagetable_t l0;
+  uint64 pa, flags;
+  int level;
+
+  pte = walkleaf(pagetable, va, &level);
+  if(pte == 0 || level == 0)
+    return 0;
+  if(level > 1)
+    panic("uvmsplit: gigapage");
+  if((l0 = (pagetable_t)kalloc_zeroed()) == 0)
+    return -1;
+
+  pa = PTE2PA(*pte);
+  flags = PTE_FLAGS(*pte);
+  ksplit((void*)pa, SUPERPGORDER);
+  for(int i = 0; i < 512; i++)
+    l0[i] = PA2PTE(pa + i * PGSIZE) | flags;
+  *pte = PA2PTE(l0) | PTE_V;
+  return 0;
+}
+
+// Give pagetable a private copy of the level-0 page-table
+// page that maps va, if fork() left it shared, so that its
+// PTEs can be changed. Returns 0 on success, -1 if out of
+// memory.
+int
+uvmunshare(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+
+  pte = walklevel(pagetable, va, 0, 1);
+  if(pte == 0 || (*pte & PTE_V) == 0 || PTE_LEAF(*pte))
+    return 0;
+  return unsharetable(pte);
+}
+
+// Did reclaim() drop the page at va? Its PTE is then left
+// marked, and unlike a page that was never touched, it has
+// no reservation.
+int
+uvmdropped(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+
+  pte = walklevel(pagetable, va, 0, 0);
+  return pte != 0 && (*pte & PTE_V) == 0 && (*pte & PTE_DROPPED) != 0;
+}
+
+// Is the page at va out in swap?
+int
+uvmswapped(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+
+  pte = walklevel(pagetable, va, 0, 0);
+  return pte != 0 && PTE_SWAPPED(*pte);
+}
+
+// Read the page at va back in from swap, and map it.
+// pagetable must be the current process's.
+// Returns its physical address, or 0.
+static uint64
+swapfault(pagetable_t pagetable, uint64 va)
+{
+  struct proc *p = myproc();
+  pte_t old;
+  uint64 pa;
+  int locked, pinned;
+
+  push_off();
+  locked = mycpu()->noff > 1;
+  pop_off();
+  if(locked)
+    return 0; //can't wait for the disk, see loadrange()
+
+  //reclaim() rewrites the page tables of sleeping processes
+  //that are not pinned, so pin p while swapin() sleeps, and
+  //the PTE is still old afterwards
+  va = PGROUNDDOWN(va);
+  old = *walklevel(pagetable, va, 0, 0);
+  pinned = p->pinned;
+  p->pinned = 1;
+  pa = swapin(PTE2SLOT(old));
+  p->pinned = pinned;
+  if(pa == 0)
+    return 0;
+  if(mappages(pagetable, va, PGSIZE, pa, (PTE_FLAGS(old) & ~PTE_DROPPED) | PTE_A) != 0){
+    kfree((void*)pa);
+    return 0;
+  }
+  swapfree(PTE2SLOT(old));
+  return pa;
 }
 
 // create an empty user page table.
@@ -245,10 +555,9 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kalloc_zeroed();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -262,14 +571,37 @@ uvmfirst(pagetable_t pagetable, uchar *src, uint sz)
 
   if(sz >= PGSIZE)
     panic("uvmfirst: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
   memmove(mem, src, sz);
 }
 
+// Try to map a zeroed megapage at the 2 MiB aligned va.
+// Returns 0 on success, -1 if va's level-1 PTE is in use or
+// there is no free 2 MiB block.
+static int
+uvmallocsuper(pagetable_t pagetable, uint64 va, int xperm)
+{
+  pte_t *pte;
+  char *mem;
+
+  pte = walklevel(pagetable, va, 0, 1);
+  if(pte != 0 && (*pte & PTE_V))
+    return -1;
+  if((mem = kalloc_order(SUPERPGORDER)) == 0)
+    return -1;
+  memset(mem, 0, SUPERPGSIZE);
+  if(mapleaves(pagetable, va, SUPERPGSIZE, (uint64)mem, PTE_R|PTE_U|xperm, 1) != 0){
+    kfree_order(mem, SUPERPGORDER);
+    return -1;
+  }
+  return 0;
+}
+
 // Allocate PTEs and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
+// 2 MiB aligned stretches that are covered completely get a
+// megapage when a 2 MiB block is free.
 uint64
 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 {
@@ -281,12 +613,16 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    if(a % SUPERPGSIZE == 0 && a + SUPERPGSIZE <= PGROUNDUP(newsz) &&
+       uvmallocsuper(pagetable, a, xperm) == 0){
+      a += SUPERPGSIZE - PGSIZE;
+      continue;
+    }
+    mem = kalloc_zeroed();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -299,7 +635,8 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
-// process size.  Returns the new process size.
+// process size.  Returns the new process size, which is still
+// oldsz if a megapage had to be split but memory ran out.
 uint64
 uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 {
@@ -308,7 +645,13 @@ uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 
   if(PGROUNDUP(newsz) < PGROUNDUP(oldsz)){
     int npages = (PGROUNDUP(oldsz) - PGROUNDUP(newsz)) / PGSIZE;
-    uvmunmap(pagetable, PGROUNDUP(newsz), npages, 1);
+    //keep the part of a megapage, or of a page-table page
+    //shared with a fork()ed process, below newsz
+    if(PGROUNDUP(newsz) % SUPERPGSIZE != 0 &&
+       (uvmsplit(pagetable, PGROUNDUP(newsz)) < 0 || uvmunshare(pagetable, PGROUNDUP(newsz)) < 0))
+      return oldsz;
+    //untouched pages give back their reservation
+    kunreserve(uvmunmap(pagetable, PGROUNDUP(newsz), npages, 1));
   }
 
   return newsz;
@@ -340,58 +683,87 @@ void
 uvmfree(pagetable_t pagetable, uint64 sz)
 {
   if(sz > 0)
-    uvmunmap(pagetable, 0, PGROUNDUP(sz)/PGSIZE, 1);
+    kunreserve(uvmunmap(pagetable, 0, PGROUNDUP(sz)/PGSIZE, 1));
   freewalk(pagetable);
 }
 
 // Given a parent process's page table, copy
 // its memory into a child's page table.
 // cow - copy
+// Rather than copying PTEs, the child shares each of the
+// parent's level-0 page-table pages, with all their pages
+// made copy-on-write. Whichever process first changes a
+// PTE in a shared page-table page gets a private copy of
+// it; see unsharetable(). So fork() costs one PTE per
+// 2 MiB, not one per page.
+// pages the parent has not touched yet stay unmapped in
+// the child too, and get a reservation of their own.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 {
-  pte_t *pte;
-  uint64 pa, i;
-  uint flags;
+  pte_t *pte, *npte;
+  pagetable_t l0;
+  uint64 i, a, end, holes = 0;
 
-  for(i = 0; i < sz; i += PGSIZE)
+  for(i = 0; i < sz; i += SUPERPGSIZE)
   {
-    if((pte = walk(old, i, 0)) == 0)
-    {
-      panic("uvmcopy: pte should exist");
-    }
-    if((*pte & PTE_V) == 0)
+    end = i + SUPERPGSIZE < PGROUNDUP(sz) ? i + SUPERPGSIZE : PGROUNDUP(sz);
+    pte = walklevel(old, i, 0, 1);
+    if(pte == 0 || (*pte & PTE_V) == 0)
     {
-      panic("uvmcopy: page not present");
+      holes += (end - i) / PGSIZE;
+      continue;
     }
-    pa = PTE2PA(*pte);
-    //pa is the target physical address
+    if(PTE_LEAF(*pte) && uvmsplit(old, i) < 0)
+    //megapages are private: break it up, and share
+    //the 4 KiB pages copy-on-write as usual
+      goto err;
 
-    if(*pte & PTE_W)
-    //If it's read only originally, do not 
-    //set the write bit
+    l0 = (pagetable_t)PTE2PA(*pte);
+    for(int j = 0; j < 512; j++)
     {
-      *pte &= ~PTE_W;
-      *pte |= PTE_COW;
+      a = i + j * PGSIZE;
+      if(l0[j] == 0 || ((l0[j] & PTE_V) && iszeropage(PTE2PA(l0[j]))))
+      {
+        //untouched, or only read through the zero page
+        if(a < end)
+          holes++;
+        continue;
+      }
+      if((l0[j] & PTE_V) == 0)
+      {
+        //pages reclaim() dropped were mapped once, so
+        //the parent has no reservation for them either
+        continue;
+      }
+      if(l0[j] & PTE_W)
+      //If it's read only originally, do not 
+      //set the write bit
+      {
+        l0[j] &= ~PTE_W;
+        l0[j] |= PTE_COW;
+      }
     }
-    // use cow-copy(lazy copy), thus forbid "write" first and tag "cow"
-
-    flags = PTE_FLAGS(*pte);
-    //flags is the permission of the page
 
-    if(mappages(new, i, PGSIZE, pa, flags) != 0)
-    //This mapping maps the new pagetable with the same 
-    //physical address as the old pagetable(lazy copy)
-    {
-      uvmunmap(new, 0, i / PGSIZE, 1);
-      return -1;
-    }
-    count_incre(pa);
-    //remember to maintain the ref count
+    if((npte = walklevel(new, i, 1, 1)) == 0)
+      goto err;
+    count_incre((uint64)l0);
+    //the page-table page now has one more user, its
+    //pages still have one reference from it
+    *npte = PA2PTE(l0) | PTE_V;
+  }
+  if(kreserve(holes) < 0)
+  {
+    uvmunmap(new, 0, PGROUNDUP(sz) / PGSIZE, 1);
+    return -1;
   }
   return 0;
+
+ err:
+  uvmunmap(new, 0, i / PGSIZE, 1);
+  return -1;
 }
 
 //check if the page is a cow page
@@ -410,47 +782,187 @@ int is_cow(pagetable_t pagetable, uint64 va)
 }
 
 
-// Copy a physical page
-int cow_fault_handler(pagetable_t pagetable, uint64 va)
+// Resolve a write to the copy-on-write page at va:
+// copy the page, or just make it writable again if this
+// page table holds the last reference to it.
+// Returns the physical address of the now-writable page,
+// or 0 if va is not a writable user page or memory ran out.
+uint64
+cow_fault_handler(pagetable_t pagetable, uint64 va)
 {
+  pte_t *pte;
+  uint64 pa, new_pa;
+  int flags, level;
+
   if(va >= MAXVA)
   {
     return 0;
   }
   va = PGROUNDDOWN(va);
-  pte_t *pte;
-  uint64 pa;
-  pte = walk(pagetable, va, 0);
-  if(pte == 0 || !(*pte & PTE_V) || !(*pte & PTE_U) || !(*pte & PTE_COW))
+  pte = walkleaf(pagetable, va, &level);
+  if(pte == 0)
+  {
+    //not touched yet: fault it in, then check it is writable
+    if(lazyfault(pagetable, va, 1) == 0)
+      return 0;
+    pte = walkleaf(pagetable, va, &level);
+  }
+  if(!(*pte & PTE_U))
   {
     return 0;
   }
   pa = PTE2PA(*pte);
   //This is the old physical address
+  if(level > 0)
+  {
+    //megapages are never shared, so never copy-on-write
+    if(*pte & PTE_W)
+      return pa + (va & ((1L << PXSHIFT(level)) - 1));
+    return 0;
+  }
   if(*pte & PTE_W)
   {
+    *pte |= PTE_D; //the caller may write it without a fault
+    return pa;
+  }
+  if(!(*pte & PTE_COW))
+  {
+    return 0; //really read-only
+  }
+  if(!count_check(PGROUNDDOWN((uint64)pte), 1))
+  {
+    //the page-table page is still shared since fork()
+    if(uvmunshare(pagetable, va) < 0)
+      return 0;
+    pte = walk(pagetable, va, 0);
+  }
+
+  flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+
+  if(iszeropage(pa))
+  {
+    //first write to an untouched page, which is still reserved
+    if((new_pa = (uint64)kalloc_zeroed()) == 0)
+      return 0;
+    *pte = PA2PTE(new_pa) | flags;
+    kunreserve(1);
+    kfree((void *)pa);
+    return new_pa;
+  }
+
+  if(count_check(pa, 1) && !count_cached(pa))
+  {
+    //nobody else maps the page any more, take it over
+    *pte = PA2PTE(pa) | flags;
     return pa;
   }
 
-  uint64 new_pa = (uint64)kalloc();
+  new_pa = (uint64)kalloc();
   if(new_pa == 0)
   {
     return 0;
   }
+  memmove((void *)new_pa, (void *)pa, PGSIZE);
+  *pte = PA2PTE(new_pa) | flags;
+  kfree((void *)pa); //drop this page table's reference to the shared page
+  return new_pa;
+}
 
-  int flags = PTE_FLAGS(*pte);
+// Is pa the zero page?
+int
+iszeropage(uint64 pa)
+{
+  return pa == zeropage;
+}
 
-  memmove((void *)new_pa, (void *)pa, PGSIZE);
-  uvmunmap(pagetable, va, 1, 1);
-  *pte = (flags & (~PTE_COW)) | PTE_W;
-  //*pte |= PA2PTE(new_pa);
+// Map the zero page at the unmapped user address va with
+// the given permissions, copy-on-write if they include
+// PTE_W. It stands for an anonymous page that has been
+// read but not yet written: the page keeps its reservation
+// until the first write, see cow_fault_handler().
+// Returns the zero page, or 0 if out of memory.
+uint64
+uvmzero(pagetable_t pagetable, uint64 va, int perm)
+{
+  if(perm & PTE_W)
+    perm = (perm & ~PTE_W) | PTE_COW;
+  if(mappages(pagetable, PGROUNDDOWN(va), PGSIZE, zeropage, perm | PTE_A) != 0)
+    return 0;
+  count_incre(zeropage);
+  return zeropage;
+}
 
-  if(mappages(pagetable, va, PGSIZE, new_pa, flags))
-  {
-    kfree((void * )new_pa);
+// Map a page at va, an address in [lo, sz) that has no page
+// yet because sbrk() only reserved it. A read maps the zero
+// page; a write gets a zeroed page, or a megapage if the
+// whole 2 MiB stretch in [lo, sz) is still untouched.
+// Returns the physical address of va's page, or 0 if va is
+// not such an address or memory ran out.
+uint64
+uvmlazy(pagetable_t pagetable, uint64 va, uint64 lo, uint64 sz, int write)
+{
+  uint64 a;
+  char *mem;
+  int level;
+
+  if(va < lo || va >= sz || va >= MAXVA)
+    return 0;
+  va = PGROUNDDOWN(va);
+  if(walkleaf(pagetable, va, &level) != 0)
     return 0;
+  if(!write)
+    return uvmzero(pagetable, va, PTE_W|PTE_R|PTE_U);
+
+  a = SUPERPGROUNDDOWN(va);
+  if(a >= lo && a + SUPERPGSIZE <= PGROUNDUP(sz) && uvmallocsuper(pagetable, a, PTE_W) == 0){
+    //all 512 pages were unmapped, so all were reserved
+    kunreserve(SUPERPGSIZE / PGSIZE);
+    return walkaddr(pagetable, va);
   }
-  return new_pa;
+
+  if((mem = kalloc_zeroed()) == 0)
+    return 0;
+  if(mappages(pagetable, va, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_U) != 0){
+    kfree(mem);
+    return 0;
+  }
+  kunreserve(1);
+  return (uint64)mem;
+}
+
+// Fault in va if pagetable belongs to the current process
+// and va is one of its pages that were never touched, or
+// that reclaim() dropped since: read it back from swap if
+// it went there, map it from the file if it is in an
+// mmap()ed one, read it from the executable if it is in
+// one of the program's segments, else it is sbrk() memory
+// to be zeroed. write says whether the page is about to be
+// written; untouched pages that are only read map the zero
+// page.
+// Returns the physical address of va's page, or 0.
+uint64
+lazyfault(pagetable_t pagetable, uint64 va, int write)
+{
+  struct proc *p = myproc();
+  struct execseg *s;
+  struct vma *v;
+  uint64 heap;
+  int level;
+
+  if(p == 0 || pagetable != p->pagetable || va >= MAXVA)
+    return 0;
+  if(walkleaf(pagetable, va, &level) != 0)
+    return 0; //mapped, it's a protection fault
+  if(uvmswapped(pagetable, va))
+    return swapfault(pagetable, va);
+  if((v = findvma(p, va)) != 0)
+    return mmapfault(p, v, va);
+  if(va >= p->sz)
+    return 0;
+  if((s = findseg(p, va)) != 0)
+    return loadpage(p, s, va, write);
+  heap = p->nseg > 0 ? PGROUNDUP(p->seg[p->nseg - 1].end) : 0;
+  return uvmlazy(pagetable, va, heap, p->sz, write);
 }
 
 // mark a PTE invalid for user access.
@@ -466,51 +978,66 @@ uvmclear(pagetable_t pagetable, uint64 va)
   *pte &= ~PTE_U;
 }
 
+// does word w have a zero byte?
+#define HASZERO(w) (((w) - 0x0101010101010101UL) & ~(w) & 0x8080808080808080UL)
+
+// Translate user address va for a copy of up to len bytes.
+// Returns the physical address, or 0 if va is not a valid
+// user address, and sets *n to the number of bytes from va
+// that are contiguous in physical memory too: the rest of a
+// megapage, or a run of 4 KiB pages in the same page-table
+// page whose physical addresses follow each other, up to
+// len. With write set the pages must be writable, and
+// copy-on-write ones are copied first.
+static uint64
+useraddr(pagetable_t pagetable, uint64 va, uint64 len, int write, uint64 *n)
+{
+  pte_t *pte;
+  uint64 pa, end;
+  int level;
+
+  if(va >= MAXVA)
+    return 0;
+  pa = write ? cow_fault_handler(pagetable, va) : walkaddr(pagetable, va);
+  if(pa == 0)
+    return 0;
+  pa += va % PGSIZE;
+
+  pte = walkleaf(pagetable, va, &level);
+  end = (va | ((1L << PXSHIFT(level)) - 1)) + 1;
+  if(level == 0){
+    while(end - va < len && end % SUPERPGSIZE != 0){
+      pte++;
+      if((*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U) || (write && (*pte & PTE_W) == 0))
+        break;
+      if(PTE2PA(*pte) != pa + (end - va))
+        break;
+      if(write)
+        *pte |= PTE_D;
+      end += PGSIZE;
+    }
+  }
+  *n = end - va < len ? end - va : len;
+  return pa;
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
+// Copy-on-write pages are copied first.
 // Return 0 on success, -1 on error.
 int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
-  uint64 n, va0, pa0;
-  //pte_t *pte;
+  uint64 n, pa;
 
-  while(len > 0)
-  {
-    va0 = PGROUNDDOWN(dstva);
-    if(va0 >= MAXVA)
-    {
+  while(len > 0){
+    if((pa = useraddr(pagetable, dstva, len, 1, &n)) == 0)
       return -1;
-    }
-    // pte = walk(pagetable, va0, 0);
-    
-    // pa0 = PTE2PA(*pte);
-    // //Newly Added:
-    // //if this page do not permit writing
-    // //Then it's a cow-fork page
-    // //Deep copy it and enable writing
-    // if(!(*pte & PTE_W))
-    // {
-      pa0 = cow_fault_handler(pagetable, va0);
-      // if(cow_fault_handler(pagetable, va0) == -1)
-      // {
-      //   return -1;
-      // }
-      // pa0 = walkaddr(pagetable, va0);
-      if(pa0 == 0)
-      {
-        return -1;
-      }
-    //}
-
-    n = PGSIZE - (dstva - va0);
-    if(n > len)
-      n = len;
-    memmove((void *)(pa0 + (dstva - va0)), src, n);
+    memmove((void *)pa, src, n);
 
     len -= n;
     src += n;
-    dstva = va0 + PGSIZE;
+    dstva += n;
   }
   return 0;
 }
@@ -521,21 +1048,16 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
-  uint64 n, va0, pa0;
+  uint64 n, pa;
 
   while(len > 0){
-    va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if((pa = useraddr(pagetable, srcva, len, 0, &n)) == 0)
       return -1;
-    n = PGSIZE - (srcva - va0);
-    if(n > len)
-      n = len;
-    memmove(dst, (void *)(pa0 + (srcva - va0)), n);
+    memmove(dst, (void *)pa, n);
 
     len -= n;
     dst += n;
-    srcva = va0 + PGSIZE;
+    srcva += n;
   }
   return 0;
 }
@@ -543,24 +1065,33 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 // Copy a null-terminated string from user to kernel.
 // Copy bytes to dst from virtual address srcva in a given page table,
 // until a '\0', or max.
+// Aligned words without a '\0' are copied whole.
 // Return 0 on success, -1 on error.
 int
 copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
-  uint64 n, va0, pa0;
+  uint64 n, pa, w;
   int got_null = 0;
 
   while(got_null == 0 && max > 0){
-    va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if((pa = useraddr(pagetable, srcva, max, 0, &n)) == 0)
       return -1;
-    n = PGSIZE - (srcva - va0);
-    if(n > max)
-      n = max;
+    srcva += n;
+    max -= n;
 
-    char *p = (char *) (pa0 + (srcva - va0));
+    char *p = (char *) pa;
     while(n > 0){
+      if(n >= 8 && ((uint64)p % 8) == 0 && !HASZERO(*(uint64*)p)){
+        w = *(uint64*)p;
+        if(((uint64)dst % 8) == 0)
+          *(uint64*)dst = w;
+        else
+          memmove(dst, p, 8);
+        n -= 8;
+        p += 8;
+        dst += 8;
+        continue;
+      }
       if(*p == '\0'){
         *dst = '\0';
         got_null = 1;
@@ -569,12 +1100,9 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
         *dst = *p;
       }
       --n;
-      --max;
       p++;
       dst++;
     }
-
-    srcva = va0 + PGSIZE;
   }
   if(got_null){
     return 0;
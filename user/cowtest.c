@@ -117,6 +117,72 @@ threetest()
   printf("ok\n");
 }
 
+// fork() shares page-table pages between parent and
+// child. writes, sbrk() and a second fork() in the child
+// must each give it private ones without the parent
+// seeing any change.
+void
+tabletest()
+{
+  int sz = 4 * 1024 * 1024;
+  int xstatus;
+
+  printf("table: ");
+
+  char *p = sbrk(sz);
+  if(p == (char*)0xffffffffffffffffL){
+    printf("sbrk(%d) failed\n", sz);
+    exit(-1);
+  }
+  for(char *q = p; q < p + sz; q += 4096)
+    *(int*)q = q - p;
+
+  int pid = fork();
+  if(pid < 0){
+    printf("fork() failed\n");
+    exit(-1);
+  }
+  if(pid == 0){
+    for(char *q = p; q < p + sz; q += 2*4096)
+      *(int*)q = -1;
+    int pid2 = fork();
+    if(pid2 < 0){
+      printf("fork() failed\n");
+      exit(-1);
+    }
+    if(pid2 == 0){
+      // cut the second 2 MiB in half
+      sbrk(-(sz/4));
+      for(char *q = p; q < p + sz - sz/4; q += 4096){
+        if(*(int*)q != ((q - p) % (2*4096) == 0 ? -1 : q - p)){
+          printf("error: grandchild read the wrong value\n");
+          exit(1);
+        }
+      }
+      exit(0);
+    }
+    wait(&xstatus);
+    exit(xstatus);
+  }
+
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+  for(char *q = p; q < p + sz; q += 4096){
+    if(*(int*)q != q - p){
+      printf("error: child wrote to parent\n");
+      exit(1);
+    }
+  }
+
+  if(sbrk(-sz) == (char*)0xffffffffffffffffL){
+    printf("sbrk(-%d) failed\n", sz);
+    exit(-1);
+  }
+
+  printf("ok\n");
+}
+
 char junk1[4096];
 int fds[2];
 char junk2[4096];
@@ -189,6 +255,8 @@ main(int argc, char *argv[])
   threetest();
   threetest();
 
+  tabletest();
+
   filetest();
 
   printf("ALL COW TESTS PASSED\n");
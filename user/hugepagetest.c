@@ -0,0 +1,129 @@
+//
+// tests for megapage-backed heaps: sbrk() of whole 2 MiB
+// stretches, fork() of such a heap, and shrinking it to
+// the middle of a megapage.
+//
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define NSUPER 4
+
+// sbrk() up to the next 2 MiB boundary, then NSUPER megapages.
+char *
+growaligned()
+{
+  uint64 cur = (uint64)sbrk(0);
+  char *p;
+
+  if(cur % SUPERPGSIZE != 0 && sbrk(SUPERPGSIZE - cur % SUPERPGSIZE) == (char*)-1){
+    printf("sbrk to align failed\n");
+    exit(1);
+  }
+  p = sbrk(NSUPER * SUPERPGSIZE);
+  if(p == (char*)-1){
+    printf("sbrk(%d) failed\n", NSUPER * SUPERPGSIZE);
+    exit(1);
+  }
+  return p;
+}
+
+void
+check(char *p, uint64 n, int v, char *what)
+{
+  for(uint64 i = 0; i < n; i += PGSIZE){
+    if(*(int*)(p + i) != v + i / PGSIZE){
+      printf("%s: page %d has %d instead of %d\n", what, i / PGSIZE,
+             *(int*)(p + i), v + i / PGSIZE);
+      exit(1);
+    }
+  }
+}
+
+void
+checkzero(char *p, uint64 n, char *what)
+{
+  for(uint64 i = 0; i < n; i++){
+    if(p[i] != 0){
+      printf("%s: byte %d is %d\n", what, i, p[i]);
+      exit(1);
+    }
+  }
+}
+
+void
+fill(char *p, uint64 n, int v)
+{
+  for(uint64 i = 0; i < n; i += PGSIZE)
+    *(int*)(p + i) = v + i / PGSIZE;
+}
+
+void
+forktest()
+{
+  char *p;
+  int pid, xstatus;
+
+  printf("fork: ");
+  p = growaligned();
+  checkzero(p, NSUPER * SUPERPGSIZE, "fresh heap");
+  fill(p, NSUPER * SUPERPGSIZE, 1000);
+
+  pid = fork();
+  if(pid < 0){
+    printf("fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    check(p, NSUPER * SUPERPGSIZE, 1000, "child");
+    fill(p, NSUPER * SUPERPGSIZE, 2000);
+    check(p, NSUPER * SUPERPGSIZE, 2000, "child after write");
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+  check(p, NSUPER * SUPERPGSIZE, 1000, "parent after child wrote");
+
+  sbrk(-NSUPER * SUPERPGSIZE);
+  printf("ok\n");
+}
+
+void
+shrinktest()
+{
+  char *p;
+  uint64 cut = SUPERPGSIZE + SUPERPGSIZE / 2;
+
+  printf("shrink: ");
+  p = growaligned();
+  fill(p, NSUPER * SUPERPGSIZE, 3000);
+
+  // cut off the last megapage and a half
+  if(sbrk(-cut) == (char*)-1){
+    printf("sbrk(-%d) failed\n", cut);
+    exit(1);
+  }
+  check(p, NSUPER * SUPERPGSIZE - cut, 3000, "after shrink");
+
+  // grow back: the new memory must be zeroed
+  if(sbrk(cut) == (char*)-1){
+    printf("sbrk(%d) failed\n", cut);
+    exit(1);
+  }
+  check(p, NSUPER * SUPERPGSIZE - cut, 3000, "after regrow");
+  checkzero(p + NSUPER * SUPERPGSIZE - cut, cut, "regrown memory");
+
+  sbrk(-NSUPER * SUPERPGSIZE);
+  printf("ok\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  forktest();
+  shrinktest();
+  printf("ALL HUGEPAGE TESTS PASSED\n");
+  exit(0);
+}
@@ -0,0 +1,543 @@
+//
+// tests for lazy (demand-zero) sbrk(), and for page reclaim.
+//
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "kernel/param.h"
+#include "kernel/sysinfo.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define REGION_SZ (16 * 1024 * 1024)
+
+// initialised, so it is in the executable's data segment
+char initdata[2 * PGSIZE] = { 1 };
+
+// zeroed, so it is in the BSS
+char zerobss[64 * PGSIZE];
+
+// pages handed out by kalloc() so far, on all CPUs.
+uint64
+nalloc()
+{
+  struct sysinfo info;
+  uint64 n = 0;
+
+  if(sysinfo(&info) < 0){
+    printf("sysinfo failed\n");
+    exit(1);
+  }
+  for(int i = 0; i < NCPU; i++)
+    n += info.kmem[i].nalloc;
+  return n;
+}
+
+// a big sbrk() must not allocate, and touching a few
+// of its pages must give zeroed, private memory.
+void
+sparse_memory(char *s)
+{
+  char *i, *prev_end, *new_end;
+  uint64 n0;
+
+  n0 = nalloc();
+  prev_end = sbrk(REGION_SZ);
+  if(prev_end == (char*)-1){
+    printf("%s: sbrk() failed\n", s);
+    exit(1);
+  }
+  if(nalloc() - n0 > REGION_SZ / PGSIZE / 2){
+    printf("%s: sbrk() allocated %d pages\n", s, nalloc() - n0);
+    exit(1);
+  }
+  new_end = prev_end + REGION_SZ;
+
+  for(i = prev_end + PGSIZE; i < new_end; i += 64 * PGSIZE){
+    if(*(char**)i != 0){
+      printf("%s: untouched page not zeroed\n", s);
+      exit(1);
+    }
+    *(char**)i = i;
+  }
+  for(i = prev_end + PGSIZE; i < new_end; i += 64 * PGSIZE){
+    if(*(char**)i != i){
+      printf("%s: failed to read value from memory\n", s);
+      exit(1);
+    }
+  }
+
+  sbrk(-REGION_SZ);
+}
+
+// fork() and shrinking sbrk() of a heap full of untouched pages.
+void
+sparse_memory_unmap(char *s)
+{
+  char *i, *prev_end, *new_end;
+  int pid, xstatus;
+
+  prev_end = sbrk(REGION_SZ);
+  if(prev_end == (char*)-1){
+    printf("%s: sbrk() failed\n", s);
+    exit(1);
+  }
+  new_end = prev_end + REGION_SZ;
+
+  for(i = prev_end; i < new_end; i += 64 * PGSIZE)
+    *(char**)i = i;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork() failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = prev_end; i < new_end; i += 64 * PGSIZE){
+      if(*(char**)i != i){
+        printf("%s: child lost a touched page\n", s);
+        exit(1);
+      }
+      if(*(char**)(i + 32 * PGSIZE) != 0){
+        printf("%s: child's untouched page not zeroed\n", s);
+        exit(1);
+      }
+      *(char**)(i + 32 * PGSIZE) = i;
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+  for(i = prev_end; i < new_end; i += 64 * PGSIZE){
+    if(*(char**)(i + 32 * PGSIZE) != 0){
+      printf("%s: child's write showed up in parent\n", s);
+      exit(1);
+    }
+  }
+
+  // cut off the second half, grow back: must be zeroed again
+  sbrk(-REGION_SZ / 2);
+  sbrk(REGION_SZ / 2);
+  for(i = prev_end + REGION_SZ / 2; i < new_end; i += 64 * PGSIZE){
+    if(*(char**)i != 0){
+      printf("%s: regrown page not zeroed\n", s);
+      exit(1);
+    }
+  }
+
+  sbrk(-REGION_SZ);
+}
+
+#define ZERO_PAGES 1024
+
+// reading untouched heap and BSS pages must not allocate
+// memory, and the first write to one must give it a page of
+// its own.
+void
+zero_page(char *s)
+{
+  char *p;
+  uint64 n0;
+  int i, sum = 0;
+
+  if((p = sbrk(ZERO_PAGES * PGSIZE)) == (char*)-1){
+    printf("%s: sbrk() failed\n", s);
+    exit(1);
+  }
+  n0 = nalloc();
+  for(i = 0; i < ZERO_PAGES; i++)
+    sum += p[i * PGSIZE + i % PGSIZE];
+  for(i = 0; i < sizeof(zerobss); i += PGSIZE)
+    sum += zerobss[i];
+  if(sum != 0){
+    printf("%s: untouched page not zeroed\n", s);
+    exit(1);
+  }
+  // page-table pages only
+  if(nalloc() - n0 > 16){
+    printf("%s: reading untouched pages allocated %d pages\n", s, nalloc() - n0);
+    exit(1);
+  }
+
+  p[5 * PGSIZE] = 1;
+  zerobss[5 * PGSIZE] = 1;
+  if(p[5 * PGSIZE] != 1 || zerobss[5 * PGSIZE] != 1){
+    printf("%s: failed to read value from memory\n", s);
+    exit(1);
+  }
+  if(p[4 * PGSIZE] != 0 || p[6 * PGSIZE] != 0 || zerobss[4 * PGSIZE] != 0 || zerobss[6 * PGSIZE] != 0){
+    printf("%s: write showed up in another page\n", s);
+    exit(1);
+  }
+  sbrk(-ZERO_PAGES * PGSIZE);
+}
+
+// system calls must fault in untouched pages they copy to or from.
+void
+syscall_arg(char *s)
+{
+  char *p;
+  int fds[2];
+
+  p = sbrk(2 * PGSIZE);
+  if(p == (char*)-1){
+    printf("%s: sbrk() failed\n", s);
+    exit(1);
+  }
+  if(pipe(fds) < 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+
+  // copyin() from an untouched page
+  if(write(fds[1], p + PGSIZE, 8) != 8){
+    printf("%s: write() from untouched page failed\n", s);
+    exit(1);
+  }
+  // copyout() to an untouched page
+  if(read(fds[0], p, 8) != 8){
+    printf("%s: read() to untouched page failed\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < 8; i++){
+    if(p[i] != 0){
+      printf("%s: read() returned bad data\n", s);
+      exit(1);
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  sbrk(-2 * PGSIZE);
+}
+
+// sbrk() must fail, not promise memory that isn't there.
+void
+oom(char *s)
+{
+  char *p;
+  uint64 n = 0;
+  int pid, xstatus;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork() failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    while((p = sbrk(1024 * 1024)) != (char*)-1)
+      n += 1024 * 1024;
+    if(n == 0 || n > 1024L * 1024 * 1024){
+      printf("%s: sbrk() handed out %d bytes\n", s, n);
+      exit(1);
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+}
+
+// system calls must load pages of the program's own segments,
+// even when they copy with locks held.
+void
+exec_segments(char *s)
+{
+  char *p = initdata + PGSIZE; // no one touched this page yet
+  char buf[8];
+  int fds[2], fd;
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  // pipewrite() copies with the pipe's spinlock held
+  if(write(fds[1], p, 4) != 4 || write(fds[1], "abcd", 4) != 4){
+    printf("%s: write() from data segment failed\n", s);
+    exit(1);
+  }
+  if(read(fds[0], buf, 8) != 8 || memcmp(buf, "\0\0\0\0abcd", 8) != 0){
+    printf("%s: read() returned bad data\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  // readi() copies with the executable's own inode locked
+  if((fd = open("lazytests", O_RDONLY)) < 0){
+    printf("%s: open(lazytests) failed\n", s);
+    exit(1);
+  }
+  if(read(fd, p, 4) != 4 || p[0] != 0x7f || p[1] != 'E'){
+    printf("%s: read() of own executable failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(initdata[0] != 1){
+    printf("%s: data segment not loaded\n", s);
+    exit(1);
+  }
+}
+
+// the working-set estimate must count the pages the
+// process keeps using.
+#define WS_PAGES 64
+
+void
+working_set(char *s)
+{
+  struct sysinfo info;
+  char *p;
+  int start = uptime();
+
+  if((p = sbrk(WS_PAGES * PGSIZE)) == (char*)-1){
+    printf("%s: sbrk() failed\n", s);
+    exit(1);
+  }
+  do {
+    for(int i = 0; i < WS_PAGES; i++)
+      p[i * PGSIZE]++;
+    if(sysinfo(&info) < 0){
+      printf("%s: sysinfo() failed\n", s);
+      exit(1);
+    }
+    if(info.wss > (uint64)sbrk(0) / PGSIZE + 1){
+      printf("%s: working set of %d pages is bigger than the process\n", s, info.wss);
+      exit(1);
+    }
+    if(info.wss >= WS_PAGES)
+      return;
+  } while(uptime() - start < 100);
+  printf("%s: working set is %d pages, expected at least %d\n", s, info.wss, WS_PAGES);
+  exit(1);
+}
+
+#define RECLAIM_PAGES 32
+
+// does the mapping of reclaimfile at p hold what
+// reclaim_pages() wrote to it?
+int
+reclaim_check(char *p)
+{
+  for(int i = 0; i < RECLAIM_PAGES * PGSIZE; i += 512){
+    if(p[i] != 'a' + i / PGSIZE % 26)
+      return 0;
+  }
+  return 1;
+}
+
+// under memory pressure, cold pages of an mmap()ed file must
+// be dropped rather than sbrk() failing early, and read back
+// in when they are touched again.
+void
+reclaim_pages(char *s)
+{
+  struct sysinfo info;
+  char buf[512], *p;
+  uint64 n0, n = 0;
+  int fd, fd2, pid, xstatus, fds[2], i, j, t;
+
+  unlink("reclaimgo");
+  if((fd = open("reclaimfile", O_CREATE|O_RDWR)) < 0){
+    printf("%s: open(reclaimfile) failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < RECLAIM_PAGES; i++){
+    memset(buf, 'a' + i % 26, sizeof(buf));
+    for(j = 0; j < PGSIZE; j += sizeof(buf)){
+      if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+        printf("%s: write() failed\n", s);
+        exit(1);
+      }
+    }
+  }
+  if(pipe(fds) < 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork() failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    p = mmap(0, RECLAIM_PAGES * PGSIZE, PROT_READ, MAP_SHARED, fd, 0);
+    if(p == (char*)-1 || !reclaim_check(p))
+      exit(1);
+    write(fds[1], "x", 1);
+    // sleep until the parent is done, without a system call
+    // that pins the pages, such as read()
+    for(t = 0; (fd2 = open("reclaimgo", O_RDONLY)) < 0; t++){
+      if(t > 300)
+        exit(1);
+      sleep(1);
+    }
+    close(fd2);
+    exit(reclaim_check(p) ? 0 : 1);
+  }
+
+  if(read(fds[0], buf, 1) != 1){
+    printf("%s: child failed to map the file\n", s);
+    exit(1);
+  }
+  if(sysinfo(&info) < 0){
+    printf("%s: sysinfo() failed\n", s);
+    exit(1);
+  }
+  n0 = info.nreclaimed;
+  while(sbrk(1024 * 1024) != (char*)-1)
+    n += 1024 * 1024;
+  if(sysinfo(&info) < 0){
+    printf("%s: sysinfo() failed\n", s);
+    exit(1);
+  }
+  sbrk(-n);
+  if((fd2 = open("reclaimgo", O_CREATE|O_RDWR)) < 0){
+    printf("%s: open(reclaimgo) failed\n", s);
+    exit(1);
+  }
+  close(fd2);
+  wait(&xstatus);
+  close(fd);
+  unlink("reclaimgo");
+  unlink("reclaimfile");
+  if(info.nreclaimed == n0){
+    printf("%s: no pages reclaimed before sbrk() failed\n", s);
+    exit(1);
+  }
+  if(xstatus != 0){
+    printf("%s: mapped file pages lost\n", s);
+    exit(1);
+  }
+}
+
+#define SWAP_PAGES 512
+
+// does the memory at p hold what swap_pages() wrote to it?
+int
+swap_check(char *p)
+{
+  for(int i = 0; i < SWAP_PAGES; i++){
+    if(*(int*)(p + i * PGSIZE) != i || p[i * PGSIZE + PGSIZE - 1] != (char)i)
+      return 0;
+  }
+  return 1;
+}
+
+// under memory pressure, cold sbrk() memory of a sleeping
+// process must go out to swap, and come back intact when it
+// is touched again.
+void
+swap_pages(char *s)
+{
+  struct sysinfo info;
+  char buf[1], *p;
+  uint64 n = 0;
+  int fd2, pid, xstatus, fds[2], i, t;
+
+  unlink("swapgo");
+  if(pipe(fds) < 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork() failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if((p = sbrk(SWAP_PAGES * PGSIZE)) == (char*)-1)
+      exit(1);
+    for(i = 0; i < SWAP_PAGES; i++){
+      *(int*)(p + i * PGSIZE) = i;
+      p[i * PGSIZE + PGSIZE - 1] = i;
+    }
+    write(fds[1], "x", 1);
+    // see reclaim_pages()
+    for(t = 0; (fd2 = open("swapgo", O_RDONLY)) < 0; t++){
+      if(t > 600)
+        exit(1);
+      sleep(1);
+    }
+    close(fd2);
+    exit(swap_check(p) ? 0 : 1);
+  }
+
+  if(read(fds[0], buf, 1) != 1){
+    printf("%s: child failed to allocate\n", s);
+    exit(1);
+  }
+  while(sbrk(1024 * 1024) != (char*)-1)
+    n += 1024 * 1024;
+  if(sysinfo(&info) < 0){
+    printf("%s: sysinfo() failed\n", s);
+    exit(1);
+  }
+  sbrk(-n);
+  if((fd2 = open("swapgo", O_CREATE|O_RDWR)) < 0){
+    printf("%s: open(swapgo) failed\n", s);
+    exit(1);
+  }
+  close(fd2);
+  wait(&xstatus);
+  unlink("swapgo");
+  if(info.nswapped == 0){
+    printf("%s: nothing swapped out before sbrk() failed\n", s);
+    exit(1);
+  }
+  if(xstatus != 0){
+    printf("%s: swapped pages lost\n", s);
+    exit(1);
+  }
+}
+
+struct test {
+  void (*f)(char *);
+  char *s;
+} tests[] = {
+  { sparse_memory, "lazy alloc"},
+  { sparse_memory_unmap, "lazy unmap"},
+  { zero_page, "zero page"},
+  { syscall_arg, "lazy syscall"},
+  { exec_segments, "lazy exec"},
+  { oom, "out of memory"},
+  { working_set, "working set"},
+  { reclaim_pages, "reclaim"},
+  { swap_pages, "swap"},
+  { 0, 0},
+};
+
+int
+main(int argc, char *argv[])
+{
+  int pid, xstatus, fail = 0;
+
+  for(struct test *t = tests; t->s != 0; t++){
+    printf("running test %s\n", t->s);
+    pid = fork();
+    if(pid < 0){
+      printf("fork() failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      t->f(t->s);
+      exit(0);
+    }
+    wait(&xstatus);
+    if(xstatus != 0){
+      printf("test %s: FAILED\n", t->s);
+      fail = 1;
+    } else {
+      printf("test %s: OK\n", t->s);
+    }
+  }
+  if(fail){
+    printf("SOME TESTS FAILED\n");
+    exit(1);
+  }
+  printf("ALL TESTS PASSED\n");
+  exit(0);
+}
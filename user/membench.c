@@ -0,0 +1,124 @@
+//
+// microbenchmark for the kernel's memset(), memmove() and
+// memcmp(). The Makefile links in a copy of kernel/string.c
+// with its symbols renamed k_memset() and so on, so this
+// times the very code the kernel runs, next to simple
+// byte-at-a-time loops.
+//
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+void *k_memset(void*, int, uint);
+void *k_memmove(void*, const void*, uint);
+int k_memcmp(const void*, const void*, uint);
+
+#define BUFSZ (64 * PGSIZE)
+#define TOTAL (64L * 1024 * 1024)   // bytes per run()
+#define MINTICKS 20                 // shortest measurement
+#define TICKUS (CLOCKINTERVAL / 10) // a tick, with qemu's 10 MHz timer
+
+char *src, *dst;
+
+void
+byte_memset(void *dst, int c, uint n)
+{
+  char *d = dst;
+
+  while(n-- > 0)
+    *d++ = c;
+}
+
+void
+byte_memmove(void *dst, const void *src, uint n)
+{
+  const char *s = src;
+  char *d = dst;
+
+  while(n-- > 0)
+    *d++ = *s++;
+}
+
+int
+byte_memcmp(const void *v1, const void *v2, uint n)
+{
+  const uchar *s1 = v1, *s2 = v2;
+
+  for(; n > 0; n--, s1++, s2++){
+    if(*s1 != *s2)
+      return *s1 - *s2;
+  }
+  return 0;
+}
+
+// run one of the operations over TOTAL bytes in chunks of
+// n, with the source offset by off bytes. src and dst hold
+// the same bytes, so memcmp() looks at all of them.
+void
+run(int op, uint n, int off)
+{
+  for(long done = 0; done < TOTAL; done += n){
+    char *s = src + off + (done % (BUFSZ - n - 8));
+    char *d = dst + (done % (BUFSZ - n - 8));
+    switch(op){
+    case 0: k_memset(d, 1, n); break;
+    case 1: byte_memset(d, 1, n); break;
+    case 2: k_memmove(d, s, n); break;
+    case 3: byte_memmove(d, s, n); break;
+    case 4: k_memcmp(d, s, n); break;
+    case 5: byte_memcmp(d, s, n); break;
+    }
+  }
+}
+
+void
+bench(char *name, int op, uint n, int off)
+{
+  int t0, ticks;
+  long bytes = 0, rate;
+
+  // start on a tick boundary, and run for long enough
+  // that the tick count is good to a few percent.
+  t0 = uptime();
+  while(uptime() == t0)
+    ;
+  t0 = uptime();
+  do {
+    run(op, n, off);
+    bytes += TOTAL;
+  } while((ticks = uptime() - t0) < MINTICKS);
+
+  // in hundredths of a GB/s
+  rate = bytes / ((long)ticks * TICKUS * 10);
+  printf("%s %d bytes%s: %d.%d%d GB/s\n", name, n, off ? " unaligned" : "",
+         (int)(rate / 100), (int)(rate / 10 % 10), (int)(rate % 10));
+}
+
+int
+main(int argc, char *argv[])
+{
+  uint sizes[] = { 64, PGSIZE, 16 * PGSIZE };
+
+  src = sbrk(BUFSZ);
+  dst = sbrk(BUFSZ);
+  if(src == (char*)-1 || dst == (char*)-1){
+    printf("membench: sbrk failed\n");
+    exit(1);
+  }
+  memset(src, 'x', BUFSZ);
+  memset(dst, 'x', BUFSZ);
+
+  for(int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++){
+    bench("memset", 0, sizes[i], 0);
+    bench("byte memset", 1, sizes[i], 0);
+    bench("memmove", 2, sizes[i], 0);
+    bench("memmove", 2, sizes[i], 3);
+    bench("byte memmove", 3, sizes[i], 0);
+    bench("memcmp", 4, sizes[i], 0);
+    bench("memcmp", 4, sizes[i], 3);
+    bench("byte memcmp", 5, sizes[i], 0);
+  }
+  exit(0);
+}
@@ -8,6 +8,7 @@
 
 void mmap_test();
 void fork_test();
+void shared_test();
 char buf[BSIZE];
 
 #define MAP_FAILED ((char *) -1)
@@ -17,6 +18,7 @@ main(int argc, char *argv[])
 {
   mmap_test();
   fork_test();
+  shared_test();
   printf("mmaptest: all tests succeeded\n");
   exit(0);
 }
@@ -302,3 +304,84 @@ fork_test(void)
 
   printf("fork_test OK\n");
 }
+
+//
+// write a MAP_SHARED mapping in a child, which unmaps it.
+// check that the parent, a new mapping and the file all
+// see the change, and that the mappings stay one page.
+//
+void
+shared_test(void)
+{
+  int fd, fd1;
+  int pid;
+  char b;
+  const char * const f = "mmap.dur";
+
+  printf("shared_test starting\n");
+  testname = "shared_test";
+
+  makefile(f);
+  if ((fd = open(f, O_RDWR)) == -1)
+    err("open (8)");
+  char *p1 = mmap(0, PGSIZE*2, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p1 == MAP_FAILED)
+    err("mmap (9)");
+  if (p1[0] != 'A')
+    err("shared mismatch (1)");
+
+  if((pid = fork()) < 0)
+    err("fork");
+  if (pid == 0) {
+    p1[0] = 'B';
+    if (munmap(p1, PGSIZE*2) == -1)
+      err("munmap (8)");
+    exit(0);
+  }
+
+  int status = -1;
+  wait(&status);
+  if(status != 0){
+    printf("shared_test failed\n");
+    exit(1);
+  }
+
+  if (p1[0] != 'B')
+    err("parent does not see the child's write");
+  char *p2 = mmap(0, PGSIZE*2, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p2 == MAP_FAILED)
+    err("mmap (10)");
+  if (p2[0] != 'B')
+    err("new mapping does not see the child's write");
+  if ((fd1 = open(f, O_RDONLY)) == -1)
+    err("open (9)");
+  if (read(fd1, &b, 1) != 1)
+    err("read (2)");
+  if (b != 'B')
+    err("file does not contain the child's write");
+  if (close(fd1) == -1)
+    err("close (7)");
+
+  // the two mappings must still share one page.
+  p1[1] = 'C';
+  if (p2[1] != 'C')
+    err("second mapping does not see a write to the first");
+  p2[2] = 'D';
+  if (p1[2] != 'D')
+    err("first mapping does not see a write to the second");
+
+  // and write() must reach it too.
+  if (write(fd, "E", 1) != 1)
+    err("write (3)");
+  if (p1[0] != 'E' || p2[0] != 'E')
+    err("mappings do not see write()");
+
+  if (munmap(p1, PGSIZE*2) == -1 || munmap(p2, PGSIZE*2) == -1)
+    err("munmap (9)");
+  if (close(fd) == -1)
+    err("close (8)");
+  if (unlink(f) == -1)
+    err("unlink (4)");
+
+  printf("shared_test OK\n");
+}
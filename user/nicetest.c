@@ -0,0 +1,74 @@
+//
+// tests for setpriority() and the scheduler.
+//
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define NSPIN   8
+#define NSLEEP  20
+
+// bad pids fail, and nice values are clamped.
+void
+nicebad()
+{
+  printf("bad: ");
+  if(setpriority(-1, 0) != -1 || setpriority(1000000, 0) != -1){
+    printf("set the priority of a missing process\n");
+    exit(1);
+  }
+  if(setpriority(0, 100) != 0 || setpriority(getpid(), -100) != 0){
+    printf("setpriority() of self failed\n");
+    exit(1);
+  }
+  setpriority(0, 0);
+  printf("ok\n");
+}
+
+// a process that mostly sleeps must stay responsive while
+// CPU-bound background processes keep every CPU busy.
+void
+nicelatency()
+{
+  int pids[NSPIN], i, t0, t;
+
+  printf("latency: ");
+  for(i = 0; i < NSPIN; i++){
+    if((pids[i] = fork()) < 0){
+      printf("fork() failed\n");
+      exit(1);
+    }
+    if(pids[i] == 0){
+      setpriority(0, 19);
+      for(;;)
+        ;
+    }
+  }
+  setpriority(0, -20);
+
+  t0 = uptime();
+  for(i = 0; i < NSLEEP; i++)
+    sleep(1);
+  t = uptime() - t0;
+
+  for(i = 0; i < NSPIN; i++){
+    kill(pids[i]);
+    wait(0);
+  }
+  setpriority(0, 0);
+  // each sleep(1) ends on the next tick; allow some slack
+  if(t > 3 * NSLEEP){
+    printf("%d sleeps of one tick took %d ticks\n", NSLEEP, t);
+    exit(1);
+  }
+  printf("ok\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  nicebad();
+  nicelatency();
+  printf("ALL NICE TESTS PASSED\n");
+  exit(0);
+}
@@ -57,9 +57,13 @@ struct backcmd {
 
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
+void syntax(char*);
 struct cmd *parsecmd(char*);
+void freecmd(struct cmd*);
 void runcmd(struct cmd*) __attribute__((noreturn));
 
+int badsyntax;  // set by syntax() while parsing
+
 // Execute cmd.  Never returns.
 void
 runcmd(struct cmd *cmd)
@@ -137,6 +141,76 @@ runcmd(struct cmd *cmd)
   exit(0);
 }
 
+// Can cmd run without a copy of the shell, that is, is it
+// made of programs, pipes and redirections only?
+int
+spawnable(struct cmd *cmd)
+{
+  switch(cmd->type){
+  case EXEC:
+    return 1;
+  case REDIR:
+    return spawnable(((struct redircmd*)cmd)->cmd);
+  case PIPE:
+    return spawnable(((struct pipecmd*)cmd)->left) &&
+           spawnable(((struct pipecmd*)cmd)->right);
+  }
+  return 0;
+}
+
+// Start the spawnable cmd with spawn() rather than
+// fork() and exec(), with fds as its standard input,
+// output and error. Returns the number of processes
+// started, for the caller to wait for.
+int
+spawncmd(struct cmd *cmd, int *fds)
+{
+  int p[2], nfds[3], n;
+  struct execcmd *ecmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  switch(cmd->type){
+  default:
+    panic("spawncmd");
+
+  case EXEC:
+    ecmd = (struct execcmd*)cmd;
+    if(ecmd->argv[0] == 0)
+      return 0;
+    if(spawn(ecmd->argv[0], ecmd->argv, fds) < 0){
+      fprintf(2, "exec %s failed\n", ecmd->argv[0]);
+      return 0;
+    }
+    return 1;
+
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    memmove(nfds, fds, sizeof(nfds));
+    if((nfds[rcmd->fd] = open(rcmd->file, rcmd->mode)) < 0){
+      fprintf(2, "open %s failed\n", rcmd->file);
+      return 0;
+    }
+    n = spawncmd(rcmd->cmd, nfds);
+    close(nfds[rcmd->fd]);
+    return n;
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    if(pipe(p) < 0)
+      panic("pipe");
+    memmove(nfds, fds, sizeof(nfds));
+    nfds[1] = p[1];
+    n = spawncmd(pcmd->left, nfds);
+    memmove(nfds, fds, sizeof(nfds));
+    nfds[0] = p[0];
+    n += spawncmd(pcmd->right, nfds);
+    close(p[0]);
+    close(p[1]);
+    return n;
+  }
+}
+
 int
 getcmd(char *buf, int nbuf)
 {
@@ -152,7 +226,9 @@ int
 main(void)
 {
   static char buf[100];
-  int fd;
+  static int stdfds[3] = { 0, 1, 2 };
+  struct cmd *cmd;
+  int fd, n;
 
   // Ensure that three file descriptors are open.
   while((fd = open("console", O_RDWR)) >= 0){
@@ -171,9 +247,21 @@ main(void)
         fprintf(2, "cannot cd %s\n", buf+3);
       continue;
     }
-    if(fork1() == 0)
-      runcmd(parsecmd(buf));
-    wait(0);
+    cmd = parsecmd(buf);
+    if(badsyntax){
+      freecmd(cmd);
+      continue;
+    }
+    if(spawnable(cmd)){
+      // most commands: no need to copy the shell
+      for(n = spawncmd(cmd, stdfds); n > 0; n--)
+        wait(0);
+    } else {
+      if(fork1() == 0)
+        runcmd(cmd);
+      wait(0);
+    }
+    freecmd(cmd);
   }
   exit(0);
 }
@@ -185,6 +273,15 @@ panic(char *s)
   exit(1);
 }
 
+// Report a syntax error in the command being parsed.
+void
+syntax(char *s)
+{
+  if(!badsyntax)
+    fprintf(2, "%s\n", s);
+  badsyntax = 1;
+}
+
 int
 fork1(void)
 {
@@ -337,12 +434,13 @@ parsecmd(char *s)
   char *es;
   struct cmd *cmd;
 
+  badsyntax = 0;
   es = s + strlen(s);
   cmd = parseline(&s, es);
   peek(&s, es, "");
-  if(s != es){
+  if(s != es && !badsyntax){
     fprintf(2, "leftovers: %s\n", s);
-    panic("syntax");
+    syntax("syntax");
   }
   nulterminate(cmd);
   return cmd;
@@ -386,8 +484,10 @@ parseredirs(struct cmd *cmd, char **ps, char *es)
 
   while(peek(ps, es, "<>")){
     tok = gettoken(ps, es, 0, 0);
-    if(gettoken(ps, es, &q, &eq) != 'a')
-      panic("missing file for redirection");
+    if(gettoken(ps, es, &q, &eq) != 'a'){
+      syntax("missing file for redirection");
+      break;
+    }
     switch(tok){
     case '<':
       cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
@@ -412,8 +512,10 @@ parseblock(char **ps, char *es)
     panic("parseblock");
   gettoken(ps, es, 0, 0);
   cmd = parseline(ps, es);
-  if(!peek(ps, es, ")"))
-    panic("syntax - missing )");
+  if(!peek(ps, es, ")")){
+    syntax("syntax - missing )");
+    return cmd;
+  }
   gettoken(ps, es, 0, 0);
   cmd = parseredirs(cmd, ps, es);
   return cmd;
@@ -438,13 +540,18 @@ parseexec(char **ps, char *es)
   while(!peek(ps, es, "|)&;")){
     if((tok=gettoken(ps, es, &q, &eq)) == 0)
       break;
-    if(tok != 'a')
-      panic("syntax");
+    if(tok != 'a'){
+      syntax("syntax");
+      break;
+    }
     cmd->argv[argc] = q;
     cmd->eargv[argc] = eq;
     argc++;
-    if(argc >= MAXARGS)
-      panic("too many args");
+    if(argc >= MAXARGS){
+      syntax("too many args");
+      argc--;
+      break;
+    }
     ret = parseredirs(ret, ps, es);
   }
   cmd->argv[argc] = 0;
@@ -498,3 +605,32 @@ nulterminate(struct cmd *cmd)
   }
   return cmd;
 }
+
+// Free the command tree that parsecmd() built.
+void
+freecmd(struct cmd *cmd)
+{
+  if(cmd == 0)
+    return;
+
+  switch(cmd->type){
+  case REDIR:
+    freecmd(((struct redircmd*)cmd)->cmd);
+    break;
+
+  case PIPE:
+    freecmd(((struct pipecmd*)cmd)->left);
+    freecmd(((struct pipecmd*)cmd)->right);
+    break;
+
+  case LIST:
+    freecmd(((struct listcmd*)cmd)->left);
+    freecmd(((struct listcmd*)cmd)->right);
+    break;
+
+  case BACK:
+    freecmd(((struct backcmd*)cmd)->cmd);
+    break;
+  }
+  free(cmd);
+}
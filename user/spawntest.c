@@ -0,0 +1,80 @@
+//
+// tests for spawn().
+//
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+// the child's output goes where fds says, and spawn()
+// returns its pid for wait().
+void
+spawnpipe()
+{
+  int p[2], fds[3], pid, xpid, xstatus, n;
+  char buf[32];
+  char *argv[] = { "echo", "spawned", 0 };
+
+  printf("pipe: ");
+  if(pipe(p) < 0){
+    printf("pipe() failed\n");
+    exit(1);
+  }
+  fds[0] = -1;
+  fds[1] = p[1];
+  fds[2] = 2;
+  if((pid = spawn("echo", argv, fds)) < 0){
+    printf("spawn() failed\n");
+    exit(1);
+  }
+  close(p[1]);
+  n = 0;
+  while(n < sizeof(buf) - 1 && read(p[0], buf + n, 1) == 1)
+    n++;
+  buf[n] = 0;
+  close(p[0]);
+  // the child got only fds 1 and 2, so EOF above means
+  // it exited and the pipe has no writer left
+  if(strcmp(buf, "spawned\n") != 0){
+    printf("wrong output %s\n", buf);
+    exit(1);
+  }
+  xpid = wait(&xstatus);
+  if(xpid != pid || xstatus != 0){
+    printf("wait() returned %d, status %d\n", xpid, xstatus);
+    exit(1);
+  }
+  printf("ok\n");
+}
+
+// bad programs and file descriptors fail in the parent.
+void
+spawnbad()
+{
+  int fds[3] = { 0, 1, 42 };
+  char *argv[] = { "echo", 0 };
+
+  printf("bad: ");
+  if(spawn("nosuchprogram", argv, 0) >= 0){
+    printf("spawned a missing program\n");
+    exit(1);
+  }
+  if(spawn("echo", argv, fds) >= 0){
+    printf("spawned with a closed fd\n");
+    exit(1);
+  }
+  if(wait(0) != -1){
+    printf("a failed spawn() left a child\n");
+    exit(1);
+  }
+  printf("ok\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  spawnpipe();
+  spawnbad();
+  printf("ALL SPAWN TESTS PASSED\n");
+  exit(0);
+}
@@ -1,5 +1,6 @@
 #include "kernel/types.h"
 #include "kernel/riscv.h"
+#include "kernel/param.h"
 #include "kernel/sysinfo.h"
 #include "user/user.h"
 
@@ -120,6 +121,45 @@ void testproc() {
   }
 }
 
+void testkmem() {
+  struct sysinfo info0, info1;
+  uint64 alloc0 = 0, alloc1 = 0, freed0 = 0, freed1 = 0, cached = 0;
+  int npages = 10;
+
+  sinfo(&info0);
+  for(int i = 0; i < NCPU; i++){
+    alloc0 += info0.kmem[i].nalloc;
+    freed0 += info0.kmem[i].nfreed;
+    cached += info0.kmem[i].nfree;
+  }
+  if(cached * PGSIZE > info0.freemem){
+    printf("sysinfotest: FAIL per-CPU caches hold %d pages, more than free mem\n", cached);
+    exit(1);
+  }
+
+  if((uint64)sbrk(npages * PGSIZE) == 0xffffffffffffffff){
+    printf("sbrk failed");
+    exit(1);
+  }
+  for(int i = 0; i < npages; i++)
+    *(sbrk(0) - (i + 1) * PGSIZE) = 1;
+  if((uint64)sbrk(-npages * PGSIZE) == 0xffffffffffffffff){
+    printf("sbrk failed");
+    exit(1);
+  }
+
+  sinfo(&info1);
+  for(int i = 0; i < NCPU; i++){
+    alloc1 += info1.kmem[i].nalloc;
+    freed1 += info1.kmem[i].nfreed;
+  }
+  if(alloc1 - alloc0 < npages || freed1 - freed0 < npages){
+    printf("sysinfotest: FAIL %d pages allocated, %d freed; expected at least %d\n",
+           alloc1 - alloc0, freed1 - freed0, npages);
+    exit(1);
+  }
+}
+
 void testbad() {
   int pid = fork();
   int xstatus;
@@ -148,6 +188,7 @@ main(int argc, char *argv[])
   testcall();
   testmem();
   testproc();
+  testkmem();
   printf("sysinfotest: OK\n");
   exit(0);
 }
@@ -1,7 +1,5 @@
-#ifdef LAB_MMAP
 typedef unsigned long size_t;
 typedef long int off_t;
-#endif
 struct stat;
 
 struct sysinfo;
@@ -35,6 +33,10 @@ int trace(int);
 int sysinfo(struct sysinfo *);
 int sigalarm(int ticks, void (*handler)());
 int sigreturn(void);
+int spawn(const char*, char**, int*);
+void *mmap(void*, size_t, int, int, int, off_t);
+int munmap(void*, size_t);
+int setpriority(int, int);
 
 //Newly added
 
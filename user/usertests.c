@@ -730,6 +730,103 @@ exectest(char *s)
 
 }
 
+// a program's file can't be truncated or written while a
+// process runs it, since the running text is the file's
+// cached pages.
+void
+textbusy(char *s)
+{
+  int fd, in[2], out[2], pid, n, xstatus;
+  char *catargv[] = { "cat-busy", 0 };
+  char c;
+
+  // a copy of cat, which runs until its input is closed.
+  unlink("cat-busy");
+  if((fd = open("cat", O_RDONLY)) < 0){
+    printf("%s: open cat failed\n", s);
+    exit(1);
+  }
+  int fd1 = open("cat-busy", O_CREATE|O_WRONLY);
+  if(fd1 < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  while((n = read(fd, buf, sizeof(buf))) > 0){
+    if(write(fd1, buf, n) != n){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+  close(fd1);
+
+  if(pipe(in) < 0 || pipe(out) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(0);
+    dup(in[0]);
+    close(1);
+    dup(out[1]);
+    close(in[0]);
+    close(in[1]);
+    close(out[0]);
+    close(out[1]);
+    exec("cat-busy", catargv);
+    printf("%s: exec cat-busy failed\n", s);
+    exit(1);
+  }
+  close(in[0]);
+  close(out[1]);
+
+  // once a byte comes back through it, cat-busy is running.
+  if(write(in[1], "x", 1) != 1 || read(out[0], &c, 1) != 1 || c != 'x'){
+    printf("%s: cat-busy did not run\n", s);
+    exit(1);
+  }
+
+  if((fd = open("cat-busy", O_WRONLY|O_TRUNC)) >= 0){
+    printf("%s: truncated a running program\n", s);
+    exit(1);
+  }
+  if((fd = open("cat-busy", O_WRONLY)) < 0){
+    printf("%s: open cat-busy failed\n", s);
+    exit(1);
+  }
+  if(write(fd, "junk", 4) >= 0){
+    printf("%s: wrote to a running program\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // it must still run as it did.
+  if(write(in[1], "y", 1) != 1 || read(out[0], &c, 1) != 1 || c != 'y'){
+    printf("%s: cat-busy broke\n", s);
+    exit(1);
+  }
+  close(in[1]);
+  wait(&xstatus);
+  close(out[0]);
+  if(xstatus != 0){
+    printf("%s: cat-busy failed\n", s);
+    exit(1);
+  }
+
+  // no one runs it now.
+  if((fd = open("cat-busy", O_WRONLY|O_TRUNC)) < 0){
+    printf("%s: can't truncate cat-busy after it exited\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("cat-busy");
+}
+
 // simple fork and pipe read/write
 
 void
@@ -2593,6 +2690,7 @@ struct test {
   {createtest, "createtest"},
   {dirtest, "dirtest"},
   {exectest, "exectest"},
+  {textbusy, "textbusy"},
   {pipe1, "pipe1"},
   {killstatus, "killstatus"},
   {preempt, "preempt"},
@@ -41,4 +41,8 @@ entry("pgaccess");
 entry("trace");
 entry("sysinfo");
 entry("sigalarm");
-entry("sigreturn");
\ No newline at end of file
+entry("sigreturn");
+entry("spawn");
+entry("mmap");
+entry("munmap");
+entry("setpriority");